@@ -23,8 +23,13 @@
 #include "musicaggregatorscope.h"
 #include "../utils/i18n.h"
 #include "../utils/bufferedresultforwarder.h"
+#include "../utils/childcategoryforwarder.h"
+#include "../utils/childhealth.h"
+#include "../utils/filteredresultforwarder.h"
+#include "../utils/sharedsearch.h"
+#include <chrono>
+#include <iostream>
 #include <memory>
-#include <map>
 #include <mutex>
 #include <algorithm>
 
@@ -33,6 +38,7 @@
 #include <unity/scopes/CategoryRenderer.h>
 #include <unity/scopes/Category.h>
 #include <unity/scopes/CannedQuery.h>
+#include <unity/scopes/QueryCtrl.h>
 #include <unity/scopes/Location.h>
 #include <unity/scopes/SearchReply.h>
 #include <unity/scopes/SearchMetadata.h>
@@ -40,6 +46,10 @@
 
 using namespace unity::scopes;
 
+// how long the page waits for a remote child scope before the categories
+// after it are shown; its late results are still appended
+static const std::chrono::milliseconds CHILD_SCOPE_DEADLINE(2500);
+
 // FIXME: once child scopes are updated to handle is_aggregated flag, they should provide
 // own renderer for aggregator and these definitions should be removed
 static const char SEVENDIGITAL_CATEGORY_DEFINITION[] = R"(
@@ -190,32 +200,56 @@ static char YOUTUBE_SEARCH_CATEGORY_DEFINITION[] = R"(
 )";
 
 MusicAggregatorQuery::MusicAggregatorQuery(CannedQuery const& query, SearchMetadata const& hints,
-        ChildScopeList const& scopes
+        ChildScopeList const& scopes,
+        std::shared_ptr<ChildHealthTracker> const& child_health,
+        std::shared_ptr<SearchCoalescer> const& coalescer
         ) :
     SearchQueryBase(query, hints),
-    child_scopes(scopes)
+    child_scopes(scopes),
+    child_health(child_health),
+    child_searches(query, hints, coalescer)
 {
     std::reverse(child_scopes.begin(), child_scopes.end());
 }
 
-MusicAggregatorQuery::~MusicAggregatorQuery() {
+std::vector<ChildSearchStats> MusicAggregatorQuery::child_stats() {
+    return child_searches.stats();
 }
 
 void MusicAggregatorQuery::cancelled() {
+    child_searches.cancel();
 }
 
 void MusicAggregatorQuery::run(unity::scopes::SearchReplyProxy const& parent_reply)
 {
-    std::vector<unity::scopes::utility::BufferedResultForwarder::SPtr> replies;
+    child_searches.start();
+    search(parent_reply);
+}
+
+void MusicAggregatorQuery::search(unity::scopes::SearchReplyProxy const& parent_reply)
+{
+    std::vector<std::shared_ptr<BufferedResultForwarder>> replies;
     ChildScopeList scopes;
     const std::string department_id = "aggregated:musicaggregator";
+    const std::string query_string = query().query_string();
+
+    const CannedQuery sevendigital_query(MusicAggregatorScope::SEVENDIGITAL, query_string, "newreleases");
+    const CannedQuery soundcloud_query(MusicAggregatorScope::SOUNDCLOUD, query_string, "");
+    const CannedQuery songkick_query(MusicAggregatorScope::SONGKICK, query_string, "");
+    const CannedQuery youtube_query(MusicAggregatorScope::YOUTUBE, query_string, department_id);
 
-    const CannedQuery sevendigital_query(MusicAggregatorScope::SEVENDIGITAL, query().query_string(), "newreleases");
-    const CannedQuery soundcloud_query(MusicAggregatorScope::SOUNDCLOUD, query().query_string(), "");
-    const CannedQuery songkick_query(MusicAggregatorScope::SONGKICK, query().query_string(), "");
-    const CannedQuery youtube_query(MusicAggregatorScope::YOUTUBE, query().query_string(), department_id);
+    const bool empty_search = query_string.empty();
 
-    const bool empty_search = query().query_string().empty();
+    // surfacing results are cached for a while
+    std::shared_ptr<SharedSearch> recording;
+    // the follower's reply keeps this query alive until it is answered
+    if (child_searches.follow_shared_search(parent_reply, child_scopes, empty_search, recording,
+                [this, parent_reply]() { search(parent_reply); }))
+    {
+        child_searches.dispatched();
+        return;
+    }
+    SharedSearchGuard recording_guard(recording);
 
     //
     // register categories
@@ -231,30 +265,31 @@ void MusicAggregatorQuery::run(unity::scopes::SearchReplyProxy const& parent_rep
     auto youtube_cat = empty_search ? parent_reply->register_category("youtube", _("Popular tracks on Youtube"), "",
                 youtube_query, CategoryRenderer(YOUTUBE_SURFACING_CATEGORY_DEFINITION))
             : parent_reply->register_category("youtube", _("Youtube"), "", youtube_query, CategoryRenderer(YOUTUBE_SEARCH_CATEGORY_DEFINITION));
+    if (recording)
+    {
+        for (auto const& category: {sevendigital_cat, soundcloud_cat, songkick_cat, youtube_cat})
+        {
+            recording->record_category(category);
+        }
+    }
 
-    unity::scopes::utility::BufferedResultForwarder::SPtr next_forwarder;
-
-    //
-    // maps scope id to category id of first received result from that scope.
-    // this is used to ignore results from different categories (i.e. child scope is
-    // misbehaving when aggregated).
-    std::map<std::string, std::string> child_id_to_category_id;
-    std::mutex child_id_map_mutex;
+    std::shared_ptr<BufferedResultForwarder> next_forwarder;
 
     for (auto const& child: child_scopes)
     {
-        if (child.enabled)
+        // children that keep failing are left out until it's time to probe them again
+        if (child.enabled && (child.id == MusicAggregatorScope::LOCALSCOPE || !child_health || child_health->should_search(child.id)))
         {
             scopes.push_back(child);
 
             if (child.id == MusicAggregatorScope::LOCALSCOPE)
             {
-                next_forwarder = std::make_shared<BufferedResultForwarder>(parent_reply, next_forwarder);
+                next_forwarder = make_filtered_forwarder(parent_reply, next_forwarder, PassThroughFilter());
                 replies.push_back(next_forwarder);
             }
             else if (child.id == MusicAggregatorScope::SEVENDIGITAL)
             {
-                next_forwarder = std::make_shared<BufferedResultForwarder>(parent_reply, next_forwarder, [sevendigital_cat](CategorisedResult& res) -> bool {
+                next_forwarder = make_filtered_forwarder(parent_reply, next_forwarder, [sevendigital_cat](CategorisedResult& res) -> bool {
                         res.set_category(sevendigital_cat);
                         return true;
                     });
@@ -262,7 +297,7 @@ void MusicAggregatorQuery::run(unity::scopes::SearchReplyProxy const& parent_rep
             }
             else if (child.id == MusicAggregatorScope::SOUNDCLOUD)
             {
-                next_forwarder = std::make_shared<BufferedResultForwarder>(parent_reply, next_forwarder, [soundcloud_cat](CategorisedResult& res) -> bool {
+                next_forwarder = make_filtered_forwarder(parent_reply, next_forwarder, [soundcloud_cat](CategorisedResult& res) -> bool {
                         if (res.category()->id() == "soundcloud_login_nag") {
                             return false;
                         }
@@ -273,7 +308,7 @@ void MusicAggregatorQuery::run(unity::scopes::SearchReplyProxy const& parent_rep
             }
             else if (child.id == MusicAggregatorScope::SONGKICK)
             {
-                next_forwarder = std::make_shared<BufferedResultForwarder>(parent_reply, next_forwarder, [songkick_cat](CategorisedResult& res) -> bool {
+                next_forwarder = make_filtered_forwarder(parent_reply, next_forwarder, [songkick_cat](CategorisedResult& res) -> bool {
                         if (res.category()->id() == "noloc") {
                             return false;
                         }
@@ -284,7 +319,7 @@ void MusicAggregatorQuery::run(unity::scopes::SearchReplyProxy const& parent_rep
             }
             else if (child.id == MusicAggregatorScope::YOUTUBE)
             {
-                next_forwarder = std::make_shared<BufferedResultForwarder>(parent_reply, next_forwarder, [youtube_cat](CategorisedResult& res) -> bool {
+                next_forwarder = make_filtered_forwarder(parent_reply, next_forwarder, [youtube_cat](CategorisedResult& res) -> bool {
                         res.set_category(youtube_cat);
                         return !res["musicaggregation"].is_null();
                     });
@@ -294,38 +329,25 @@ void MusicAggregatorQuery::run(unity::scopes::SearchReplyProxy const& parent_rep
             {
                 auto const child_id = child.id;
                 auto const child_name = child.metadata.display_name();
-                next_forwarder = std::make_shared<BufferedResultForwarder>(parent_reply, next_forwarder, [this, child_id, child_name, empty_search,
-                        parent_reply, &child_id_to_category_id, &child_id_map_mutex](CategorisedResult& res) -> bool {
-                    // register a single category for aggregated results of this child scope and update incoming results with this category;
+                next_forwarder = std::make_shared<ChildCategoryForwarder>(parent_reply, next_forwarder, [query_string, child_id, child_name, empty_search,
+                        parent_reply, recording](CategorisedResult const& first) -> Category::SCPtr {
+                    // register a single category for aggregated results of this child scope;
                     // the new category has custom id and title, but reuses the renderer of first incoming result
-                    Category::SCPtr category = parent_reply->lookup_category(child_id);
-                    if (!category) {
-                        CannedQuery category_query(child_id, query().query_string(), "");
-                        auto const renderer = res.category()->renderer_template();
-                        char title[500];
-                        if (empty_search) {
-                            /* TRANSLATORS: Featured on YouTube, Featured on Grooveshark, etc. */
-                            snprintf(title, sizeof(title), _("Featured on %s"), child_name.c_str());
-                        } else {
-                            snprintf(title, sizeof(title), _("Results from %s"), child_name.c_str());
-                        }
-                        category = parent_reply->register_category(child_id, title, "" /* icon */, category_query, renderer);
-
-                        // remember the first encountered category for this child
-                        {
-                            std::lock_guard<std::mutex> lock(child_id_map_mutex);
-                            child_id_to_category_id[child_id] = res.category()->id();
-                        }
+                    CannedQuery category_query(child_id, query_string, "");
+                    auto const renderer = first.category()->renderer_template();
+                    char title[500];
+                    if (empty_search) {
+                        /* TRANSLATORS: Featured on YouTube, Featured on Grooveshark, etc. */
+                        snprintf(title, sizeof(title), _("Featured on %s"), child_name.c_str());
+                    } else {
+                        snprintf(title, sizeof(title), _("Results from %s"), child_name.c_str());
                     }
-
+                    auto category = parent_reply->register_category(child_id, title, "" /* icon */, category_query, renderer);
+                    if (recording)
                     {
-                        std::lock_guard<std::mutex> lock(child_id_map_mutex);
-                        if (child_id_to_category_id[child_id] == res.category()->id()) {
-                            res.set_category(category);
-                            return true;
-                        }
+                        recording->record_category(category);
                     }
-                    return false; // filter out results from other categories
+                    return category;
                 });
                 replies.push_back(next_forwarder);
             }
@@ -381,6 +403,23 @@ void MusicAggregatorQuery::run(unity::scopes::SearchReplyProxy const& parent_rep
             metadata.set_location(Location(0, 0));
         }
 
-        subsearch(scopes[i], query().query_string(), dept, FilterState(), metadata, replies[i]);
+        if (scopes[i].id != MusicAggregatorScope::LOCALSCOPE)
+        {
+            replies[i]->set_deadline(child_health ? child_health->deadline(scopes[i].id, CHILD_SCOPE_DEADLINE) : CHILD_SCOPE_DEADLINE);
+        }
+        // not every child honours the cardinality, so don't buffer more than that
+        replies[i]->set_result_limit(metadata.cardinality());
+        if (child_health)
+        {
+            watch_child_health(child_health, scopes[i].id, *replies[i]);
+        }
+        if (recording)
+        {
+            recording->record_child(*replies[i]);
+        }
+        child_searches.dispatching(scopes[i].id, metadata, replies[i]);
+        child_searches.track(subsearch(scopes[i], query_string, dept, FilterState(), metadata, replies[i]), replies[i]);
     }
+    recording_guard.dispatched();
+    child_searches.dispatched();
 }
@@ -25,9 +25,20 @@
 #include <unity/scopes/CategoryRenderer.h>
 #include "../utils/utils.h"
 #include "../utils/i18n.h"
+#include "../utils/childhealth.h"
+#include "../utils/sharedsearch.h"
+
+#include <iostream>
 
 using namespace unity::scopes;
 
+// a child is skipped after this many failed searches in a row,
+// and searched again as a probe once the cooldown is over
+static const unsigned CHILD_FAILURE_THRESHOLD = 3;
+static const std::chrono::seconds CHILD_COOLDOWN(60);
+// how long the surfacing results are reused
+static const std::chrono::seconds SURFACING_CACHE_TTL(30);
+
  #ifdef CLICK_MODE
 const std::string MusicAggregatorScope::LOCALSCOPE = "com.ubuntu.scopes.mymusic_mymusic";
  #else
@@ -49,19 +60,33 @@ const std::vector<std::string> predefined_scopes {
 
 void MusicAggregatorScope::start(std::string const&) {
     init_gettext(*this);
+    child_health = std::make_shared<ChildHealthTracker>(CHILD_FAILURE_THRESHOLD, CHILD_COOLDOWN);
+    coalescer = std::make_shared<SearchCoalescer>(SURFACING_CACHE_TTL);
+    child_discovery.reset(new ChildScopeDiscovery("musicaggregator", predefined_scopes, "music"));
 }
 
 void MusicAggregatorScope::stop() {
+    // stops the registry notifications
+    child_discovery.reset();
+    if (child_health)
+    {
+        std::cerr << "Child scope health:" << std::endl;
+        child_health->dump(std::cerr);
+    }
 }
 
 SearchQueryBase::UPtr MusicAggregatorScope::search(CannedQuery const& q,
                                                    SearchMetadata const& hints) {
-    SearchQueryBase::UPtr query(new MusicAggregatorQuery(q, hints, child_scopes()));
+    SearchQueryBase::UPtr query(new MusicAggregatorQuery(q, hints, child_scopes(), child_health, coalescer));
     return query;
 }
 
 ChildScopeList MusicAggregatorScope::find_child_scopes() const
 {
+    if (child_discovery)
+    {
+        return child_discovery->find(registry());
+    }
     return find_child_scopes_by_keywords("musicaggregator", registry(), predefined_scopes, "music");
 }
 
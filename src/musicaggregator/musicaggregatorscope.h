@@ -26,6 +26,13 @@
 #include <unity/scopes/ReplyProxyFwd.h>
 #include <unity/scopes/Variant.h>
 
+#include "../utils/utils.h"
+
+#include <memory>
+
+class ChildHealthTracker;
+class SearchCoalescer;
+
 class MusicAggregatorScope : public unity::scopes::ScopeBase
 {
 public:
@@ -46,6 +53,11 @@ public:
             unity::scopes::SearchMetadata const& hints) override;
 
     virtual unity::scopes::ChildScopeList find_child_scopes() const override;
+
+private:
+    std::shared_ptr<ChildHealthTracker> child_health;
+    std::shared_ptr<SearchCoalescer> coalescer;
+    std::unique_ptr<ChildScopeDiscovery> child_discovery;
 };
 
 #endif
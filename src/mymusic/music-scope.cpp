@@ -19,9 +19,13 @@
 #include <config.h>
 #include <iostream>
 #include <algorithm>
+#include <cstdlib>
+#include <future>
 #include <gio/gio.h>
+#include <unistd.h>
 
 #include <mediascanner/MediaFile.hh>
+#include <mediascanner/MediaFileBuilder.hh>
 #include <mediascanner/Album.hh>
 #include <mediascanner/Filter.hh>
 #include <core/net/http/response.h>
@@ -36,10 +40,22 @@
 #include <unity/scopes/VariantBuilder.h>
 
 #include "music-scope.h"
+#include "../utils/cachefile.h"
+#include "../utils/storequery.h"
 #include "../utils/i18n.h"
+#include "../utils/storegeneration.h"
+#include "../utils/trace.h"
+#include "../utils/utils.h"
 
 #define MAX_RESULTS 100
 #define MAX_GENRES 100
+#define STORE_POOL_SIZE 4
+#define BIO_CACHE_TTL_HOURS (24 * 7)
+
+static const std::uint32_t WARM_START_MAGIC = 0x4d534357; // "MSCW"
+static const std::uint32_t WARM_START_VERSION = 1;
+
+static const char BIO_ENDPOINT[] = "https://dash.ubuntu.com";
 
 static const char THUMBNAILER_SCHEMA[] = "com.canonical.Unity.Thumbnailer";
 static const char THUMBNAILER_API_KEY[] = "dash-ubuntu-com-key";
@@ -214,14 +230,68 @@ using namespace unity::scopes;
 using namespace core::net;
 namespace json = Json;
 
+MusicScope::MusicScope()
+    : MusicScope(BIO_ENDPOINT) {
+}
+
+MusicScope::MusicScope(std::string const& bio_endpoint)
+    : bio_endpoint(bio_endpoint) {
+}
+
 void MusicScope::start(std::string const&) {
     init_gettext(*this);
-    store.reset(new MediaStore(MS_READ_ONLY));
-    client = http::make_client();
-    set_api_key();
+    stores.reset(new MediaStorePool(STORE_POOL_SIZE));
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        snapshot_stopping = false;
+    }
+    client = std::async(std::launch::async, []() { return http::make_client(); }).share();
+
+    // renderers only depend on the scope directory, so parse them once
+    renderers = {
+        {Renderer::GetStarted, CategoryRenderer(GET_STARTED_CATEGORY_DEFINITION)},
+        {Renderer::Songs, make_renderer(SONGS_CATEGORY_DEFINITION, MISSING_ALBUM_ART)},
+        {Renderer::Albums, make_renderer(ALBUMS_CATEGORY_DEFINITION, MISSING_ALBUM_ART)},
+        {Renderer::Artists, make_renderer(ARTISTS_CATEGORY_DEFINITION, MISSING_ALBUM_ART)},
+        {Renderer::ArtistBio, make_renderer(ARTIST_BIO_CATEGORY_DEFINITION, MISSING_ALBUM_ART)},
+        {Renderer::Aggregated, make_renderer(AGGREGATED_CATEGORY_DEFINITION, MISSING_ALBUM_ART)},
+        {Renderer::Search, make_renderer(SEARCH_CATEGORY_DEFINITION, MISSING_ALBUM_ART)},
+        {Renderer::SearchSongs, make_renderer(SEARCH_SONGS_CATEGORY_DEFINITION, MISSING_ALBUM_ART)},
+    };
+
+    load_warm_start_cache();
+
+#ifdef ENABLE_ARTIST_BIO
+    try
+    {
+        bio_cache.reset(new TtlFileCache(cache_directory() + "/biographies", std::chrono::hours(BIO_CACHE_TTL_HOURS)));
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Artist biographies won't be cached: " << e.what() << std::endl;
+    }
+#endif
+}
+
+MediaStorePool::Stats MusicScope::store_stats() const {
+    return stores ? stores->stats() : MediaStorePool::Stats();
+}
+
+CategoryRenderer MusicScope::make_renderer(std::string json_text, std::string const& fallback) const {
+    static std::string const placeholder("@FALLBACK@");
+    size_t pos = json_text.find(placeholder);
+    if (pos != std::string::npos)
+    {
+        json_text.replace(pos, placeholder.size(), scope_directory() + "/" + fallback);
+    }
+    return CategoryRenderer(json_text);
+}
+
+CategoryRenderer const& MusicScope::renderer(Renderer type) const {
+    return renderers.at(type);
 }
 
-void MusicScope::set_api_key()
+void MusicScope::set_api_key() const
 {
     // the API key is not expected to change, so don't monitor it
     GSettingsSchemaSource *src = g_settings_schema_source_get_default();
@@ -249,8 +319,45 @@ void MusicScope::set_api_key()
     }
 }
 
+std::string const& MusicScope::thumbnailer_api_key() const {
+    std::call_once(api_key_once, [this]() { set_api_key(); });
+    return api_key;
+}
+
+core::net::http::Client& MusicScope::http_client() const {
+    return *client.get();
+}
+
 void MusicScope::stop() {
-    store.reset();
+    // once stopping is set no rebuild can start, so the one running (it
+    // still uses the pool) is the last one to wait for
+    std::thread rebuild;
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        snapshot_stopping = true;
+        rebuild = std::move(snapshot_thread);
+    }
+    if (rebuild.joinable())
+    {
+        rebuild.join();
+    }
+    save_warm_start_cache();
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        snapshot.reset();
+    }
+    if (stores)
+    {
+        std::cerr << "MediaStore pool: " << store_stats() << std::endl;
+    }
+    stores.reset();
+    {
+        std::lock_guard<std::mutex> lock(artist_index_mutex);
+        artist_index.clear();
+        artist_index_valid = false;
+    }
+    std::lock_guard<std::mutex> lock(genres_mutex);
+    genres_cache.reset();
 }
 
 SearchQueryBase::UPtr MusicScope::search(CannedQuery const &q,
@@ -268,20 +375,373 @@ PreviewQueryBase::UPtr MusicScope::preview(Result const& result,
 std::string MusicScope::make_artist_art_uri(const std::string &artist, const std::string &album) const {
     auto const uri = core::net::make_uri(
             "image://artistart", {}, {{"artist", artist}, {"album", album}});
-    return client->uri_to_string(uri);
+    return http_client().uri_to_string(uri);
+}
+
+void MusicScope::refresh_artist_index(mediascanner::MediaStore const& store) const {
+    const auto generation = mediastore_generation();
+    std::lock_guard<std::mutex> lock(artist_index_mutex);
+    if (artist_index_valid && generation != 0 && generation == artist_index_generation)
+    {
+        return;
+    }
+
+    // a single pass over all albums covers every artist that has an album
+    // credited to them; albums are sorted, so keep the first non-empty one.
+    artist_index.clear();
+    for (auto const& album: store.listAlbums(mediascanner::Filter()))
+    {
+        if (!album.getTitle().empty())
+        {
+            artist_index.emplace(album.getArtist(), album.getTitle());
+        }
+    }
+    artist_index_generation = generation;
+    // an index of a database in an unknown state is rebuilt next time
+    artist_index_valid = generation != 0;
+}
+
+std::string MusicScope::artist_album(mediascanner::MediaStore const& store, const std::string &artist) const {
+    {
+        std::lock_guard<std::mutex> lock(artist_index_mutex);
+        auto const it = artist_index.find(artist);
+        if (it != artist_index.end())
+        {
+            return it->second;
+        }
+    }
+
+    // the artist only appears on albums credited to someone else (e.g.
+    // compilations), so look it up and remember the answer.
+    std::string album_name;
+    mediascanner::Filter filter;
+    filter.setArtist(artist);
+    for (auto const& album: store.listAlbums(filter))
+    {
+        album_name = album.getTitle();
+        if (!album_name.empty())
+        {
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(artist_index_mutex);
+    artist_index.emplace(artist, album_name);
+    return album_name;
+}
+
+std::shared_ptr<const std::vector<std::string>> MusicScope::genres(mediascanner::MediaStore const& store) const {
+    const auto generation = mediastore_generation();
+    if (generation == 0)
+    {
+        // the state of the database is unknown, so don't cache anything
+        return std::make_shared<const std::vector<std::string>>(store.listGenres(mediascanner::Filter()));
+    }
+    std::lock_guard<std::mutex> lock(genres_mutex);
+    if (!genres_cache || generation != genres_generation)
+    {
+        genres_cache = std::make_shared<std::vector<std::string>>(store.listGenres(mediascanner::Filter()));
+        genres_generation = generation;
+    }
+    return genres_cache;
+}
+
+std::shared_ptr<const MusicScope::SurfacingSnapshot> MusicScope::surfacing_snapshot(MediaStorePool::Handle& store) const {
+    const auto generation = mediastore_generation();
+    if (generation == 0)
+    {
+        // the state of the database is unknown, so the page can't be kept
+        if (!store)
+        {
+            store = stores->acquire();
+        }
+        return build_surfacing_snapshot(*store, generation);
+    }
+    std::unique_lock<std::mutex> lock(snapshot_mutex);
+    if (!snapshot)
+    {
+        // nothing to serve yet, so the first one is built right away
+        lock.unlock();
+        if (!store)
+        {
+            store = stores->acquire();
+        }
+        auto fresh = build_surfacing_snapshot(*store, generation);
+        lock.lock();
+        if (!snapshot)
+        {
+            snapshot = fresh;
+        }
+        return snapshot;
+    }
+
+    if (snapshot->generation != generation && !snapshot_rebuilding && !snapshot_stopping)
+    {
+        // a previous rebuild is done with the lock, so this doesn't block
+        if (snapshot_thread.joinable())
+        {
+            snapshot_thread.join();
+        }
+        snapshot_rebuilding = true;
+        snapshot_thread = std::thread([this, generation]() {
+                std::shared_ptr<const SurfacingSnapshot> fresh;
+                try
+                {
+                    auto const store = stores->acquire();
+                    fresh = build_surfacing_snapshot(*store, generation);
+                }
+                catch (const std::exception &e)
+                {
+                    std::cerr << "Failed to rebuild surfacing results: " << e.what() << std::endl;
+                }
+                std::lock_guard<std::mutex> lock(snapshot_mutex);
+                if (fresh)
+                {
+                    snapshot = fresh;
+                }
+                snapshot_rebuilding = false;
+            });
+    }
+    return snapshot;
+}
+
+std::shared_ptr<const MusicScope::SurfacingSnapshot> MusicScope::build_surfacing_snapshot(mediascanner::MediaStore const& store,
+        std::uint64_t generation) const {
+    auto fresh = std::make_shared<SurfacingSnapshot>();
+    fresh->generation = generation;
+
+    mediascanner::Filter filter;
+    filter.setLimit(MAX_RESULTS);
+    refresh_artist_index(store);
+    for (auto const& artist: store.queryArtists("", filter))
+    {
+        fresh->artists.emplace_back(artist, artist_album(store, artist));
+    }
+
+    filter.setOrder(MediaOrder::Modified);
+    filter.setReverse(true);
+    fresh->recent_songs = store.query("", AudioMedia, filter);
+    return fresh;
+}
+
+bool MusicScope::has_audio(MediaStorePool::Handle& store) const {
+    const auto generation = mediastore_generation();
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        if (snapshot && generation != 0 && snapshot->generation == generation && !snapshot->recent_songs.empty())
+        {
+            return true;
+        }
+    }
+    if (!store)
+    {
+        store = stores->acquire();
+    }
+    return store->hasMedia(AudioMedia);
+}
+
+// identifies the playlist shared by the song cards of a query
+static std::string new_playlist_id()
+{
+    static std::atomic<unsigned> counter(0);
+    return "mymusic-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+}
+
+static void write_media_file(CacheFileWriter &out, mediascanner::MediaFile const& media)
+{
+    out.put_string(media.getFileName());
+    out.put_string(media.getContentType());
+    out.put_string(media.getETag());
+    out.put_string(media.getTitle());
+    out.put_string(media.getAuthor());
+    out.put_string(media.getAlbum());
+    out.put_string(media.getAlbumArtist());
+    out.put_string(media.getDate());
+    out.put_string(media.getGenre());
+    out.put_u32(media.getDiscNumber());
+    out.put_u32(media.getTrackNumber());
+    out.put_u32(media.getDuration());
+    out.put_u32(media.getHasThumbnail() ? 1 : 0);
+    out.put_u64(media.getModificationTime());
+    out.put_u32(static_cast<std::uint32_t>(media.getType()));
+}
+
+static mediascanner::MediaFile read_media_file(CacheFileReader &in)
+{
+    mediascanner::MediaFileBuilder builder(in.get_string());
+    builder.setContentType(in.get_string());
+    builder.setETag(in.get_string());
+    builder.setTitle(in.get_string());
+    builder.setAuthor(in.get_string());
+    builder.setAlbum(in.get_string());
+    builder.setAlbumArtist(in.get_string());
+    builder.setDate(in.get_string());
+    builder.setGenre(in.get_string());
+    builder.setDiscNumber(in.get_u32());
+    builder.setTrackNumber(in.get_u32());
+    builder.setDuration(in.get_u32());
+    builder.setHasThumbnail(in.get_u32() != 0);
+    builder.setModificationTime(in.get_u64());
+    builder.setType(static_cast<mediascanner::MediaType>(in.get_u32()));
+    return builder.build();
+}
+
+std::string MusicScope::warm_start_cache_path() const {
+    return cache_directory() + "/warm-start.cache";
+}
+
+void MusicScope::load_warm_start_cache() {
+    try
+    {
+        CacheFileReader in;
+        if (!in.open(warm_start_cache_path()))
+        {
+            return;
+        }
+        if (in.get_u32() != WARM_START_MAGIC || in.get_u32() != WARM_START_VERSION)
+        {
+            std::cerr << "Ignoring warm start cache in unknown format" << std::endl;
+            return;
+        }
+        const auto generation = in.get_u64();
+        if (generation == 0 || generation != mediastore_generation())
+        {
+            // the database changed while the scope wasn't running
+            return;
+        }
+
+        auto cached = std::make_shared<SurfacingSnapshot>();
+        cached->generation = generation;
+        for (auto n = in.get_u32(); n > 0; n--)
+        {
+            auto artist = in.get_string();
+            cached->artists.emplace_back(std::move(artist), in.get_string());
+        }
+        for (auto n = in.get_u32(); n > 0; n--)
+        {
+            cached->recent_songs.push_back(read_media_file(in));
+        }
+        auto cached_genres = std::make_shared<std::vector<std::string>>();
+        for (auto n = in.get_u32(); n > 0; n--)
+        {
+            cached_genres->push_back(in.get_string());
+        }
+        std::unordered_map<std::string, std::string> cached_index;
+        for (auto n = in.get_u32(); n > 0; n--)
+        {
+            auto artist = in.get_string();
+            cached_index.emplace(std::move(artist), in.get_string());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(snapshot_mutex);
+            snapshot = cached;
+        }
+        {
+            std::lock_guard<std::mutex> lock(genres_mutex);
+            genres_cache = cached_genres;
+            genres_generation = generation;
+        }
+        std::lock_guard<std::mutex> lock(artist_index_mutex);
+        artist_index.swap(cached_index);
+        artist_index_generation = generation;
+        artist_index_valid = true;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Failed to load warm start cache: " << e.what() << std::endl;
+    }
+}
+
+void MusicScope::save_warm_start_cache() const {
+    std::shared_ptr<const SurfacingSnapshot> current;
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        current = snapshot;
+    }
+    // nothing worth saving if the surfacing page was never shown
+    if (!current || current->generation == 0)
+    {
+        return;
+    }
+
+    CacheFileWriter out;
+    out.put_u32(WARM_START_MAGIC);
+    out.put_u32(WARM_START_VERSION);
+    out.put_u64(current->generation);
+    out.put_u32(current->artists.size());
+    for (auto const& artist: current->artists)
+    {
+        out.put_string(artist.first);
+        out.put_string(artist.second);
+    }
+    out.put_u32(current->recent_songs.size());
+    for (auto const& media: current->recent_songs)
+    {
+        write_media_file(out, media);
+    }
+
+    // the genres and the artist index are only kept if they describe
+    // the same database as the snapshot
+    {
+        std::lock_guard<std::mutex> lock(genres_mutex);
+        const bool current_genres = genres_cache && genres_generation == current->generation;
+        out.put_u32(current_genres ? genres_cache->size() : 0);
+        if (current_genres)
+        {
+            for (auto const& genre: *genres_cache)
+            {
+                out.put_string(genre);
+            }
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(artist_index_mutex);
+        const bool current_index = artist_index_valid && artist_index_generation == current->generation;
+        out.put_u32(current_index ? artist_index.size() : 0);
+        if (current_index)
+        {
+            for (auto const& entry: artist_index)
+            {
+                out.put_string(entry.first);
+                out.put_string(entry.second);
+            }
+        }
+    }
+
+    try
+    {
+        out.save(warm_start_cache_path());
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Failed to save warm start cache: " << e.what() << std::endl;
+    }
 }
 
 MusicQuery::MusicQuery(MusicScope &scope, CannedQuery const& query, SearchMetadata const& hints)
     : SearchQueryBase(query, hints),
       scope(scope),
-      query_cancelled(false) {
+      query_cancelled(false),
+      max_results(query_result_limit(hints, MAX_RESULTS)) {
 }
 
 void MusicQuery::cancelled() {
     query_cancelled = true;
 }
 
+mediascanner::MediaStore const& MusicQuery::store() const {
+    // queries that are answered from the caches never open a connection
+    if (!store_handle)
+    {
+        store_handle = scope.stores->acquire();
+    }
+    return *store_handle;
+}
+
 void MusicQuery::run(SearchReplyProxy const&reply) {
+    // logs the query under the aggregator's trace id, if tracing
+    QueryTrace trace(query().scope_id(), search_metadata());
     const bool empty_search_query = query().query_string().empty();
     const bool is_aggregated = search_metadata().is_aggregated();
 
@@ -289,7 +749,7 @@ void MusicQuery::run(SearchReplyProxy const&reply) {
     {
         if (empty_search_query) // surfacing
         {
-            const CategoryRenderer renderer = make_renderer(AGGREGATED_CATEGORY_DEFINITION, MISSING_ALBUM_ART);
+            const CategoryRenderer &renderer = scope.renderer(MusicScope::Renderer::Aggregated);
             auto cat = reply->register_category(
                 "mymusic", _("My Music"), "",
                 CannedQuery(query().scope_id(), query().query_string(), ""),
@@ -298,21 +758,20 @@ void MusicQuery::run(SearchReplyProxy const&reply) {
         }
         else // non-empty search in albums and songs
         {
-            const CategoryRenderer renderer = make_renderer(SEARCH_CATEGORY_DEFINITION, MISSING_ALBUM_ART);
+            const CategoryRenderer &renderer = scope.renderer(MusicScope::Renderer::Search);
             auto cat = reply->register_category(
                 "mymusic", _("My Music"), "",
                 CannedQuery(query().scope_id(), query().query_string(), ""),
                 renderer);
-            query_artists(reply, cat);
-            query_albums(reply, cat);
-            query_songs(reply, cat);
+            search_all(reply, cat, cat, cat);
         }
+        trace.finish();
         return;
     }
 
-    if (!scope.store->hasMedia(AudioMedia))
+    if (!scope.has_audio(store_handle))
     {
-        const CategoryRenderer renderer(GET_STARTED_CATEGORY_DEFINITION);
+        const CategoryRenderer &renderer = scope.renderer(MusicScope::Renderer::GetStarted);
         auto cat = reply->register_category("mymusic-getstarted", "", "", renderer);
         CategorisedResult res(cat);
         res.set_uri(query().to_uri());
@@ -320,10 +779,18 @@ void MusicQuery::run(SearchReplyProxy const&reply) {
         res["summary"] = _("Drag and drop items from another devices. Alternatively, load your files onto a SD card.");
         res.set_art(scope.scope_directory() + "/" + "getstarted.svg");
         reply->push(res);
+        trace.finish();
         return;
     }
 
+    const auto departments_start = QueryTrace::clock::now();
     populate_departments(reply);
+    trace.span("departments", departments_start);
+    if (query_cancelled)
+    {
+        trace.finish();
+        return;
+    }
 
     auto const current_department = query().department_id();
     if (current_department == "tracks")
@@ -347,8 +814,10 @@ void MusicQuery::run(SearchReplyProxy const&reply) {
     else if (query().has_user_data() && query().user_data().get_string() == "albums_of_artist")
     {
         const std::string artist = query().query_string();
-        query_albums_by_artist(reply, artist);
+        // the biography is fetched while the albums and songs are pushed
+        auto const push_bio = query_albums_by_artist(reply, artist);
         query_songs_by_artist(reply, artist);
+        push_bio();
     }
     else // empty department id - default view
     {
@@ -358,24 +827,15 @@ void MusicQuery::run(SearchReplyProxy const&reply) {
         }
         else // non-empty search in albums and songs
         {
-            query_artists(reply);
-            query_albums(reply);
-            query_songs(reply);
+            auto const artists_cat = register_artists_category(reply);
+            auto const albums_cat = register_albums_category(reply);
+            auto const songs_cat = register_songs_category(reply);
+            search_all(reply, artists_cat, albums_cat, songs_cat);
         }
     }
+    trace.finish();
 }
 
-CategoryRenderer MusicQuery::make_renderer(std::string json_text, std::string const& fallback) const {
-    static std::string const placeholder("@FALLBACK@");
-    size_t pos = json_text.find(placeholder);
-    if (pos != std::string::npos)
-    {
-        json_text.replace(pos, placeholder.size(), scope.scope_directory() + "/" + fallback);
-    }
-    return CategoryRenderer(json_text);
-}
-
-
 void MusicQuery::populate_departments(unity::scopes::SearchReplyProxy const &reply) const
 {
     unity::scopes::Department::SPtr artists = unity::scopes::Department::create("", query(), _("Artists"));
@@ -387,8 +847,7 @@ void MusicQuery::populate_departments(unity::scopes::SearchReplyProxy const &rep
 
     if (current_department == "genres" || current_department.find("genre:") == 0)
     {
-        const mediascanner::Filter filter;
-        for (const auto &genre: scope.store->listGenres(filter))
+        for (const auto &genre: *scope.genres(store()))
         {
             if (!genre.empty())
             {
@@ -415,130 +874,176 @@ void MusicQuery::populate_departments(unity::scopes::SearchReplyProxy const &rep
 
 void MusicQuery::query_genres(unity::scopes::SearchReplyProxy const&reply) const
 {
-    const CategoryRenderer renderer = make_renderer(ALBUMS_CATEGORY_DEFINITION, MISSING_ALBUM_ART);
+    const CategoryRenderer &renderer = scope.renderer(MusicScope::Renderer::Albums);
     mediascanner::Filter filter;
 
-    auto const genres = scope.store->listGenres(filter);
+    auto const genres_list = scope.genres(store());
+    auto const& genres = *genres_list;
     auto const genre_limit = std::min(static_cast<int>(genres.size()), 10);
-    int limit = MAX_RESULTS;
+    int limit = max_results;
 
-    for (int i = 0; i < genre_limit; i++)
+    for (int i = 0; i < genre_limit && !query_cancelled; i++)
     {
         auto cat = reply->register_category("genre:" + genres[i], genres[i], "", renderer); //FIXME: how to make genre i18n-friendly?
 
         filter.setGenre(genres[i]);
-        filter.setLimit(limit);
-        for (const auto &album: scope.store->listAlbums(filter))
-        {
-            limit--;
-            if (!reply->push(create_album_result(cat, album)))
-                return;
-        }
-        if (limit <= 0)
+        const bool completed = for_each_row(query_cancelled, filter, limit,
+                [this](mediascanner::Filter const& f) { return store().listAlbums(f); },
+                [this, &reply, &cat, &limit](Album const& album) -> bool {
+                    limit--;
+                    return reply->push(create_album_result(cat, album));
+                });
+        if (!completed || limit <= 0)
         {
             break;
         }
     }
 }
 
-void MusicQuery::query_artists(unity::scopes::SearchReplyProxy const& reply, Category::SCPtr const& override_category) const
+Category::SCPtr MusicQuery::register_artists_category(unity::scopes::SearchReplyProxy const& reply) const
 {
     const bool show_title = !query().query_string().empty();
+    const CategoryRenderer &renderer = scope.renderer(query().query_string() == "" ? MusicScope::Renderer::Artists : MusicScope::Renderer::Search);
+    return reply->register_category("artists", show_title ? _("Artists") : "", SONGS_CATEGORY_ICON, renderer); //FIXME: icon
+}
 
-    auto cat = override_category;
-    if (!cat) {
-        CategoryRenderer renderer = make_renderer(query().query_string() == "" ? ARTISTS_CATEGORY_DEFINITION : SEARCH_CATEGORY_DEFINITION, MISSING_ALBUM_ART);
-        cat = reply->register_category("artists", show_title ? _("Artists") : "", SONGS_CATEGORY_ICON, renderer); //FIXME: icon
+void MusicQuery::query_artists(unity::scopes::SearchReplyProxy const& reply, Category::SCPtr const& override_category) const
+{
+    auto const cat = override_category ? override_category : register_artists_category(reply);
+    if (!query().query_string().empty())
+    {
+        fetch_artists(store(), cat, [&reply](CategorisedResult const& res) { return reply->push(res); });
+        return;
     }
 
-    CannedQuery artist_search(query());
-    artist_search.set_department_id("");
-    artist_search.set_query_string("");
-
-    mediascanner::Filter filter;
-    filter.setLimit(MAX_RESULTS);
-    for (const auto &artist: scope.store->queryArtists(query().query_string(), filter))
+    // surfacing doesn't depend on the query, so serve the precomputed page
+    auto const surfacing = scope.surfacing_snapshot(store_handle);
+    const int count = std::min(static_cast<int>(surfacing->artists.size()), max_results);
+    for (int i = 0; i < count; i++)
     {
-        artist_search.set_query_string(artist);
-        artist_search.set_user_data(Variant("albums_of_artist"));
-
-        CategorisedResult res(cat);
-        res.set_uri(artist_search.to_uri());
-        res.set_title(artist);
-
-        // find first non-empty album of this artist, needed to get artist-art
-        {
-            std::string album_name;
-            mediascanner::Filter filter;
-            filter.setArtist(artist);
-            for (auto const& album: scope.store->listAlbums(filter))
-            {
-                album_name = album.getTitle();
-                if (!album_name.empty())
-                {
-                    break;
-                }
-            }
-            res.set_art(scope.make_artist_art_uri(artist, album_name));
-        }
-
-        if(!reply->push(res))
+        auto const& artist = surfacing->artists[i];
+        if (query_cancelled || !reply->push(create_artist_result(cat, artist.first, artist.second)))
         {
             return;
         }
     }
 }
 
-void MusicQuery::query_songs(unity::scopes::SearchReplyProxy const&reply, Category::SCPtr const& override_category, bool sortByMtime) const {
+void MusicQuery::fetch_artists(mediascanner::MediaStore const& store, Category::SCPtr const& cat, ResultSink const& sink) const
+{
+    if (query_cancelled)
+    {
+        return;
+    }
+    scope.refresh_artist_index(store);
+
+    auto const query_string = query().query_string();
+    for_each_row(query_cancelled, mediascanner::Filter(), max_results,
+            [&store, &query_string](mediascanner::Filter const& f) { return store.queryArtists(query_string, f); },
+            [this, &store, &sink, &cat](std::string const& artist) -> bool {
+                // first non-empty album of this artist, needed to get artist-art
+                return sink(create_artist_result(cat, artist, scope.artist_album(store, artist)));
+            });
+}
+
+unity::scopes::CategorisedResult MusicQuery::create_artist_result(unity::scopes::Category::SCPtr const& category, std::string const& artist,
+        std::string const& album) const
+{
+    CannedQuery artist_search(query());
+    artist_search.set_department_id("");
+    artist_search.set_query_string(artist);
+    artist_search.set_user_data(Variant("albums_of_artist"));
+
+    CategorisedResult res(category);
+    res.set_uri(artist_search.to_uri());
+    res.set_title(artist);
+    res.set_art(scope.make_artist_art_uri(artist, album));
+    return res;
+}
+
+Category::SCPtr MusicQuery::register_songs_category(unity::scopes::SearchReplyProxy const& reply) const
+{
     const bool surfacing = query().query_string().empty();
-    auto cat = override_category;
-    if (!cat)
+    const CategoryRenderer &renderer = scope.renderer(surfacing ? MusicScope::Renderer::Songs : MusicScope::Renderer::SearchSongs);
+    return reply->register_category("songs", surfacing ? "" : _("Tracks"), SONGS_CATEGORY_ICON, renderer);
+}
+
+void MusicQuery::query_songs(unity::scopes::SearchReplyProxy const&reply, Category::SCPtr const& override_category, bool sortByMtime) const {
+    auto const cat = override_category ? override_category : register_songs_category(reply);
+    const ResultSink sink = [&reply](CategorisedResult const& res) { return reply->push(res); };
+    if (sortByMtime && query().query_string().empty())
     {
-        CategoryRenderer renderer = make_renderer(surfacing ? SONGS_CATEGORY_DEFINITION : SEARCH_SONGS_CATEGORY_DEFINITION, MISSING_ALBUM_ART);
-        cat = reply->register_category("songs", surfacing ? "" : _("Tracks"), SONGS_CATEGORY_ICON, renderer);
+        // the recently modified songs shown in the aggregator are precomputed
+        auto const surfacing = scope.surfacing_snapshot(store_handle);
+        emit_songs(cat, surfacing->recent_songs, sink);
+        return;
     }
+    fetch_songs(store(), cat, sink, sortByMtime);
+}
+
+void MusicQuery::fetch_songs(mediascanner::MediaStore const& store, Category::SCPtr const& cat, ResultSink const& sink, bool sortByMtime) const {
     mediascanner::Filter filter;
-    filter.setLimit(MAX_RESULTS);
     if (sortByMtime) {
         filter.setOrder(MediaOrder::Modified);
         filter.setReverse(true);
     }
 
-    auto const songs = scope.store->query(query().query_string(), AudioMedia, filter);
-    static const std::vector<mediascanner::MediaFile> empty_playlist;
+    // the playlist needs all the songs up front, so collect them first;
+    // when surfacing, it has more of them than there are cards
+    std::vector<mediascanner::MediaFile> songs;
+    auto const query_string = query().query_string();
+    if (!for_each_row(query_cancelled, filter, query_string.empty() ? MAX_RESULTS : max_results,
+            [&store, &query_string](mediascanner::Filter const& f) { return store.query(query_string, AudioMedia, f); },
+            [&songs](mediascanner::MediaFile const& media) -> bool {
+                songs.push_back(media);
+                return true;
+            }))
+    {
+        return;
+    }
+    emit_songs(cat, songs, sink);
+}
+
+void MusicQuery::emit_songs(Category::SCPtr const& cat, std::vector<mediascanner::MediaFile> const& songs, ResultSink const& sink) const {
+    const bool surfacing = query().query_string().empty();
 
-    for (const auto &media : songs) {
-        // Inline playback should only be used in surfacing mode.
-        // Attach the playlist with all songs to every card (same playlist for every card).
-        if(!reply->push(create_song_result(cat, media, surfacing, surfacing ? songs : empty_playlist)))
+    // Inline playback should only be used in surfacing mode.
+    // The playlist with all songs is built once and attached to the first
+    // card only; every card refers to it by id, so that the cards don't
+    // grow with the number of songs. Only the cards are capped by the
+    // cardinality: playing a song of the aggregator's three still queues
+    // all of them.
+    const Variant playlist = surfacing ? make_playlist(songs) : Variant();
+    const std::string playlist_id = playlist.is_null() ? std::string() : new_playlist_id();
+
+    const auto count = std::min(songs.size(), static_cast<size_t>(max_results));
+    for (size_t i = 0; i < count; i++) {
+        if(query_cancelled || !sink(create_song_result(cat, songs[i], surfacing, playlist_id, i == 0 ? playlist : Variant())))
         {
             return;
         }
     }
-
 }
 
 void MusicQuery::query_songs_by_artist(unity::scopes::SearchReplyProxy const &reply, const std::string& artist) const
 {
-    CategoryRenderer renderer = make_renderer(query().query_string() == "" ? SONGS_CATEGORY_DEFINITION : SEARCH_SONGS_CATEGORY_DEFINITION, MISSING_ALBUM_ART);
+    const CategoryRenderer &renderer = scope.renderer(query().query_string() == "" ? MusicScope::Renderer::Songs : MusicScope::Renderer::SearchSongs);
     auto cat = reply->register_category("songs", _("Tracks"), SONGS_CATEGORY_ICON, renderer);
 
     mediascanner::Filter filter;
     filter.setArtist(artist);
-    filter.setLimit(MAX_RESULTS);
 
-    for (const auto &media : scope.store->listSongs(filter)) {
-        if(!reply->push(create_song_result(cat, media)))
-        {
-            return;
-        }
-    }
+    for_each_row(query_cancelled, filter, max_results,
+            [this](mediascanner::Filter const& f) { return store().listSongs(f); },
+            [this, &reply, &cat](mediascanner::MediaFile const& media) -> bool {
+                return reply->push(create_song_result(cat, media));
+            });
 }
 
 unity::scopes::CategorisedResult MusicQuery::create_album_result(unity::scopes::Category::SCPtr const& category, mediascanner::Album const& album) const
 {
     CategorisedResult res(category);
-    res.set_uri("album:///" + scope.client->url_escape(album.getArtist()) + "/" + scope.client->url_escape(album.getTitle()));
+    res.set_uri("album:///" + scope.http_client().url_escape(album.getArtist()) + "/" + scope.http_client().url_escape(album.getTitle()));
     res.set_title(album.getTitle());
     res.set_art(album.getArtUri());
     res["artist"] = album.getArtist();
@@ -547,8 +1052,23 @@ unity::scopes::CategorisedResult MusicQuery::create_album_result(unity::scopes::
     return res;
 }
 
+unity::scopes::Variant MusicQuery::make_playlist(std::vector<mediascanner::MediaFile> const& songs)
+{
+    if (songs.empty())
+    {
+        return Variant();
+    }
+    VariantArray songsva;
+    songsva.reserve(songs.size());
+    for (auto const& song: songs)
+    {
+        songsva.push_back(Variant(song.getUri()));
+    }
+    return Variant(songsva);
+}
+
 unity::scopes::CategorisedResult MusicQuery::create_song_result(unity::scopes::Category::SCPtr const& category, mediascanner::MediaFile const& media,
-        bool audio_data, std::vector<mediascanner::MediaFile> const& album_songs) const
+        bool audio_data, std::string const& playlist_id, unity::scopes::Variant const& playlist) const
 {
     std::string uri = media.getUri();
     CategorisedResult res(category);
@@ -567,14 +1087,13 @@ unity::scopes::CategorisedResult MusicQuery::create_song_result(unity::scopes::C
         VariantMap data;
         data["uri"] = uri;
         data["duration"] = media.getDuration();
-        if (album_songs.size() > 0)
+        if (!playlist_id.empty())
         {
-            VariantArray songsva;
-            for (auto const& song: album_songs)
-            {
-                songsva.push_back(Variant(song.getUri()));
-            }
-            data["playlist"] = songsva;
+            data["playlist-id"] = playlist_id;
+        }
+        if (!playlist.is_null())
+        {
+            data["playlist"] = playlist;
         }
         res["audio-data"] = data;
     }
@@ -584,22 +1103,26 @@ unity::scopes::CategorisedResult MusicQuery::create_song_result(unity::scopes::C
 
 void MusicQuery::query_albums_by_genre(unity::scopes::SearchReplyProxy const&reply, const std::string& genre) const
 {
-    CategoryRenderer renderer = make_renderer(ALBUMS_CATEGORY_DEFINITION, MISSING_ALBUM_ART);
+    const CategoryRenderer &renderer = scope.renderer(MusicScope::Renderer::Albums);
     auto cat = reply->register_category("albums", "", SONGS_CATEGORY_ICON, renderer);
 
     mediascanner::Filter filter;
     filter.setGenre(genre);
-    filter.setLimit(MAX_RESULTS);
-    for (const auto &album: scope.store->listAlbums(filter))
-    {
-        if (!reply->push(create_album_result(cat, album)))
-        {
-            return;
-        }
-    }
+    for_each_row(query_cancelled, filter, max_results,
+            [this](mediascanner::Filter const& f) { return store().listAlbums(f); },
+            [this, &reply, &cat](Album const& album) -> bool {
+                return reply->push(create_album_result(cat, album));
+            });
+}
+
+#ifdef ENABLE_ARTIST_BIO
+static std::string biography_cache_key(const std::string& artist, const std::string &album)
+{
+    return artist + "\n" + album;
 }
+#endif
 
-std::string MusicQuery::fetch_biography_sync(const std::string& artist, const std::string &album) const
+std::string MusicQuery::fetch_biography(const std::string& artist, const std::string &album) const
 {
     std::string bio_text;
     /* Biography download is currently disabled because the
@@ -609,77 +1132,116 @@ std::string MusicQuery::fetch_biography_sync(const std::string& artist, const st
      * https://bugs.launchpad.net/bugs/1549616
      */
 #ifdef ENABLE_ARTIST_BIO
-    http::Request::Configuration config;
-    auto uri = core::net::make_uri(
-            "https://dash.ubuntu.com",
-            {"musicproxy", "v1", "artist-bio"},
-            {{"artist", artist}, {"album", album}, {"key", scope.api_key}});
-    config.uri = scope.client->uri_to_string(uri);
-    auto request = scope.client->get(config);
-    http::Request::Handler handler;
-    try
+    const std::string cache_key = biography_cache_key(artist, album);
+    if (scope.bio_cache && scope.bio_cache->get(cache_key, bio_text))
     {
-        auto response = request->execute([this](const http::Request::Progress&) -> http::Request::Progress::Next {
-                return query_cancelled ?  http::Request::Progress::Next::abort_operation : http::Request::Progress::Next::continue_operation;
-                });
-        json::Value root;
-        json::Reader reader;
-        if (reader.parse(response.body, root))
+        return bio_text;
+    }
+
+    // artist pages opened in quick succession share a single download,
+    // made with the scope's HTTP client
+    auto const download = [this, &artist, &album, &cache_key](RequestCoalescer<std::string>::Abandoned const& abandoned) -> std::string {
+        std::string text;
+        http::Request::Configuration config;
+        auto uri = core::net::make_uri(
+                scope.bio_endpoint,
+                {"musicproxy", "v1", "artist-bio"},
+                {{"artist", artist}, {"album", album}, {"key", scope.thumbnailer_api_key()}});
+        config.uri = scope.http_client().uri_to_string(uri);
+        auto request = scope.http_client().get(config);
+        try
         {
-            if (root.isObject() && root.isMember("biography"))
+            auto response = request->execute([&abandoned](const http::Request::Progress&) -> http::Request::Progress::Next {
+                    return abandoned() ?  http::Request::Progress::Next::abort_operation : http::Request::Progress::Next::continue_operation;
+                    });
+            json::Value root;
+            json::Reader reader;
+            if (reader.parse(response.body, root))
             {
-                json::Value data = root["biography"];
-                if (data.isString())
+                if (root.isObject() && root.isMember("biography"))
                 {
-                    bio_text = data.asString();
+                    json::Value data = root["biography"];
+                    if (data.isString())
+                    {
+                        text = data.asString();
+                    }
+                }
+                if (text.empty())
+                {
+                    std::cerr << "Artist info is empty for " << artist << ", " << album << std::endl;
+                }
+                // empty answers are remembered too, they are not going to change
+                // any time soon
+                if (scope.bio_cache)
+                {
+                    scope.bio_cache->put(cache_key, text);
                 }
             }
-            if (bio_text.empty())
+            else
             {
-                std::cerr << "Artist info is empty for " << artist << ", " << album << std::endl;
+                std::cerr << "Failed to parse artist-bio response: " << response.body << std::endl;
             }
         }
-        else
+        catch (const std::runtime_error &e)
         {
-            std::cerr << "Failed to parse artist-bio response: " << response.body << std::endl;
+            std::cerr << "Failed to get artist info: " << e.what() << std::endl;
         }
-    }
-    catch (const std::runtime_error &e)
-    {
-        std::cerr << "Failed to get artist info: " << e.what() << std::endl;
-    }
+        return text;
+    };
+    scope.bio_requests.run(cache_key, query_cancelled, download, bio_text);
 #endif
     return bio_text;
 }
 
-void MusicQuery::query_albums_by_artist(unity::scopes::SearchReplyProxy const &reply, const std::string& artist) const
+std::function<void()> MusicQuery::query_albums_by_artist(unity::scopes::SearchReplyProxy const &reply, const std::string& artist) const
 {
-    CategoryRenderer bio_renderer = make_renderer(ARTIST_BIO_CATEGORY_DEFINITION, MISSING_ALBUM_ART);
-    CategoryRenderer renderer = make_renderer(ALBUMS_CATEGORY_DEFINITION, MISSING_ALBUM_ART);
+    const CategoryRenderer &bio_renderer = scope.renderer(MusicScope::Renderer::ArtistBio);
+    const CategoryRenderer &renderer = scope.renderer(MusicScope::Renderer::Albums);
 
+    // the biography card is pushed last, but its category is registered
+    // first so that it is still displayed above the albums
     auto biocat = reply->register_category("bio", "", "", bio_renderer);
     auto albumcat = reply->register_category("albums", _("Albums"), SONGS_CATEGORY_ICON, renderer);
 
-    bool show_bio = true;
-    std::string bio_text;
+    std::function<void()> push_bio = []() {};
 
     mediascanner::Filter filter;
     filter.setArtist(artist);
-    filter.setLimit(MAX_RESULTS);
-    auto const albums = scope.store->listAlbums(filter);
+    std::vector<Album> albums;
+    if (!for_each_row(query_cancelled, filter, max_results,
+            [this](mediascanner::Filter const& f) { return store().listAlbums(f); },
+            [&albums](Album const& album) -> bool {
+                albums.push_back(album);
+                return true;
+            }))
+    {
+        return push_bio;
+    }
 
-    for (const auto &album: albums)
+    auto const first_album = std::find_if(albums.begin(), albums.end(), [](Album const& album) {
+            return !album.getTitle().empty();
+        });
+    if (first_album != albums.end())
     {
-        if (show_bio && !album.getTitle().empty())
+        const std::string album_title = first_album->getTitle();
+        // only a biography that isn't cached is fetched in the background
+        std::string cached_bio;
+        std::shared_future<std::string> bio_text;
+#ifdef ENABLE_ARTIST_BIO
+        const bool cached = scope.bio_cache && scope.bio_cache->get(biography_cache_key(artist, album_title), cached_bio);
+        if (!cached && search_metadata().internet_connectivity() != QueryMetadata::ConnectivityStatus::Disconnected)
         {
-            if (search_metadata().internet_connectivity() != QueryMetadata::ConnectivityStatus::Disconnected)
+            bio_text = std::async(std::launch::async, [this, artist, album_title]() {
+                    return fetch_biography(artist, album_title);
+                }).share();
+        }
+#endif
+
+        push_bio = [this, reply, biocat, artist, album_title, cached_bio, bio_text]() {
+            if (query_cancelled)
             {
-                //
-                // biography has to be the first result to display and we have all the other results ready
-                // so it's ok to fetch biography synchronously.
-                bio_text = fetch_biography_sync(artist, album.getTitle());
+                return;
             }
-
             CannedQuery artist_search(query());
             artist_search.set_department_id("");
             artist_search.set_query_string(artist);
@@ -688,44 +1250,105 @@ void MusicQuery::query_albums_by_artist(unity::scopes::SearchReplyProxy const &r
             CategorisedResult artist_info(biocat);
             artist_info.set_uri(artist_search.to_uri());
             artist_info.set_title(artist);
-            artist_info["summary"] = bio_text;
-            artist_info["art"] = scope.make_artist_art_uri(artist, album.getTitle());
-            reply->push(artist_info);
-            show_bio = false;
-        }
-        if (!reply->push(create_album_result(albumcat, album)))
+            artist_info["summary"] = bio_text.valid() ? bio_text.get() : cached_bio;
+            artist_info["art"] = scope.make_artist_art_uri(artist, album_title);
+            if (!query_cancelled)
+            {
+                reply->push(artist_info);
+            }
+        };
+    }
+
+    for (const auto &album: albums)
+    {
+        if (query_cancelled || !reply->push(create_album_result(albumcat, album)))
         {
-            return;
+            break;
         }
     }
+    return push_bio;
 }
 
-void MusicQuery::query_albums(unity::scopes::SearchReplyProxy const&reply, Category::SCPtr const& override_category) const {
+Category::SCPtr MusicQuery::register_albums_category(unity::scopes::SearchReplyProxy const& reply) const
+{
     const bool show_title = !query().query_string().empty();
+    const CategoryRenderer &renderer = scope.renderer(query().query_string() == "" ? MusicScope::Renderer::Albums : MusicScope::Renderer::Search);
+    return reply->register_category("albums", show_title ? _("Albums") : "", SONGS_CATEGORY_ICON, renderer);
+}
 
-    auto cat = override_category;
-    if (!cat)
-    {
-        CategoryRenderer renderer = make_renderer(query().query_string() == "" ? ALBUMS_CATEGORY_DEFINITION : SEARCH_CATEGORY_DEFINITION, MISSING_ALBUM_ART);
-        cat = reply->register_category("albums", show_title ? _("Albums") : "", SONGS_CATEGORY_ICON, renderer);
-    }
+void MusicQuery::query_albums(unity::scopes::SearchReplyProxy const&reply, Category::SCPtr const& override_category) const {
+    auto const cat = override_category ? override_category : register_albums_category(reply);
+    fetch_albums(store(), cat, [&reply](CategorisedResult const& res) { return reply->push(res); });
+}
 
-    mediascanner::Filter filter;
-    filter.setLimit(MAX_RESULTS);
-    for (const auto &album : scope.store->queryAlbums(query().query_string(), filter)) {
-        if (!reply->push(create_album_result(cat, album)))
+void MusicQuery::fetch_albums(mediascanner::MediaStore const& store, Category::SCPtr const& cat, ResultSink const& sink) const {
+    auto const query_string = query().query_string();
+    for_each_row(query_cancelled, mediascanner::Filter(), max_results,
+            [&store, &query_string](mediascanner::Filter const& f) { return store.queryAlbums(query_string, f); },
+            [this, &sink, &cat](Album const& album) -> bool {
+                return sink(create_album_result(cat, album));
+            });
+}
+
+void MusicQuery::search_all(unity::scopes::SearchReplyProxy const& reply, Category::SCPtr const& artists_cat,
+        Category::SCPtr const& albums_cat, Category::SCPtr const& songs_cat) const
+{
+    typedef std::vector<CategorisedResult> Results;
+    typedef std::function<void(MediaStore const&, ResultSink const&)> Fetch;
+
+    // the three lookups run at the same time when the pool has a free
+    // connection for them (never wait for it: other queries may hold the
+    // rest). A MediaStore is never used by two threads at once, so the
+    // lookups left without a connection of their own are deferred: they
+    // run on this thread, on the query's connection, when their results
+    // are collected. Results are pushed in category order.
+    MediaStore const& query_store = store();
+    auto const start_lookup = [this, &query_store](Fetch const& fetch, bool own_connection) -> std::future<Results> {
+        auto const handle = std::make_shared<MediaStorePool::Handle>();
+        if (own_connection)
         {
-            return;
+            *handle = scope.stores->try_acquire();
+        }
+        return std::async(*handle ? std::launch::async : std::launch::deferred, [&query_store, handle, fetch]() -> Results {
+                Results results;
+                fetch(*handle ? **handle : query_store, [&results](CategorisedResult const& res) -> bool {
+                        results.push_back(res);
+                        return true;
+                    });
+                return results;
+            });
+    };
+    // the artists are collected first, so they get the query's connection
+    auto artists = start_lookup([this, &artists_cat](MediaStore const& store, ResultSink const& sink) {
+            fetch_artists(store, artists_cat, sink);
+        }, false);
+    auto albums = start_lookup([this, &albums_cat](MediaStore const& store, ResultSink const& sink) {
+            fetch_albums(store, albums_cat, sink);
+        }, true);
+    auto songs = start_lookup([this, &songs_cat](MediaStore const& store, ResultSink const& sink) {
+            fetch_songs(store, songs_cat, sink);
+        }, true);
+
+    for (auto *lookup: {&artists, &albums, &songs})
+    {
+        for (auto const& res: lookup->get())
+        {
+            if (query_cancelled || !reply->push(res))
+            {
+                return;
+            }
         }
     }
 }
 
 MusicPreview::MusicPreview(MusicScope &scope, Result const& result, ActionMetadata const& hints)
     : PreviewQueryBase(result, hints),
-      scope(scope) {
+      scope(scope),
+      query_cancelled(false) {
 }
 
 void MusicPreview::cancelled() {
+    query_cancelled = true;
 }
 
 void MusicPreview::run(PreviewReplyProxy const& reply)
@@ -791,6 +1414,10 @@ void MusicPreview::song_preview(unity::scopes::PreviewReplyProxy const &reply) c
         actions.add_attribute_value("actions", builder.end());
     }
 
+    if (query_cancelled)
+    {
+        return;
+    }
     reply->push({artwork, header, actions, tracks});
 }
 
@@ -830,7 +1457,16 @@ void MusicPreview::album_preview(unity::scopes::PreviewReplyProxy const &reply)
     std::string artist = res["artist"].get_string();
     std::string album_name = res["title"].get_string();
     Album album(album_name, artist);
-    for(const auto &track : scope.store->getAlbumSongs(album)) {
+    if (query_cancelled)
+    {
+        return;
+    }
+    auto const store = scope.stores->acquire();
+    for(const auto &track : store->getAlbumSongs(album)) {
+        if (query_cancelled)
+        {
+            return;
+        }
         std::vector<std::pair<std::string, Variant>> tmp;
         tmp.emplace_back("title", Variant(track.getTitle()));
         tmp.emplace_back("source", Variant(track.getUri()));
@@ -3,19 +3,35 @@
 
 #include <memory>
 #include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include <mediascanner/MediaFile.hh>
 #include <mediascanner/MediaStore.hh>
+#include <unity/scopes/CategorisedResult.h>
+#include <unity/scopes/CategoryRenderer.h>
 #include <unity/scopes/SearchReply.h>
 #include <unity/scopes/ScopeBase.h>
 #include <unity/scopes/Variant.h>
 #include <core/net/http/client.h>
 
+#include "../utils/mediastorepool.h"
+#include "../utils/requestcoalescer.h"
+#include "../utils/ttlcache.h"
+
 class MusicScope : public unity::scopes::ScopeBase
 {
     friend class MusicQuery;
     friend class MusicPreview;
 
 public:
+    MusicScope();
     virtual void start(std::string const&) override;
     virtual void stop() override;
     virtual unity::scopes::SearchQueryBase::UPtr search(unity::scopes::CannedQuery const &q,
@@ -23,13 +39,93 @@ public:
     virtual unity::scopes::PreviewQueryBase::UPtr preview(unity::scopes::Result const& result,
                                          unity::scopes::ActionMetadata const& hints) override;
 
+    // use of the connection pool since start()
+    MediaStorePool::Stats store_stats() const;
+
+protected:
+    // tests fetch the biographies from a local server instead
+    explicit MusicScope(std::string const& bio_endpoint);
+
 private:
-    void set_api_key();
+    enum class Renderer {
+        GetStarted,
+        Songs,
+        Albums,
+        Artists,
+        ArtistBio,
+        Aggregated,
+        Search,
+        SearchSongs,
+    };
+
+    void set_api_key() const;
+    std::string const& thumbnailer_api_key() const;
+    core::net::http::Client& http_client() const;
+    unity::scopes::CategoryRenderer make_renderer(std::string json_text, std::string const& fallback) const;
+    unity::scopes::CategoryRenderer const& renderer(Renderer type) const;
     std::string make_artist_art_uri(const std::string &artist, const std::string &album) const;
+    void refresh_artist_index(mediascanner::MediaStore const& store) const;
+    std::string artist_album(mediascanner::MediaStore const& store, const std::string &artist) const;
+    std::shared_ptr<const std::vector<std::string>> genres(mediascanner::MediaStore const& store) const;
+
+    // results of the surfacing queries, which only change with the database
+    struct SurfacingSnapshot
+    {
+        std::uint64_t generation = 0;
+        // artist and the album used for its artist art
+        std::vector<std::pair<std::string, std::string>> artists;
+        // most recently modified first
+        std::vector<mediascanner::MediaFile> recent_songs;
+    };
+    // these only check a connection out into store when they need one
+    std::shared_ptr<const SurfacingSnapshot> surfacing_snapshot(MediaStorePool::Handle& store) const;
+    std::shared_ptr<const SurfacingSnapshot> build_surfacing_snapshot(mediascanner::MediaStore const& store, std::uint64_t generation) const;
+    bool has_audio(MediaStorePool::Handle& store) const;
+
+    // the snapshot, genres and artist index are saved at stop() and
+    // reused by the next start() if the database hasn't changed since
+    std::string warm_start_cache_path() const;
+    void load_warm_start_cache();
+    void save_warm_start_cache() const;
 
-    std::unique_ptr<mediascanner::MediaStore> store;
-    std::shared_ptr<core::net::http::Client> client;
-    std::string api_key;
+    // read-only connections shared by all queries and previews
+    std::unique_ptr<MediaStorePool> stores;
+    // created in the background by start(), it is not needed before the
+    // first results are made
+    std::shared_future<std::shared_ptr<core::net::http::Client>> client;
+    // base URI of the biography service
+    const std::string bio_endpoint;
+    // only needed to fetch biographies, read on first use
+    mutable std::once_flag api_key_once;
+    mutable std::string api_key;
+    // artist biographies by artist and album; null if the scope has no
+    // cache directory or is built without ENABLE_ARTIST_BIO
+    std::unique_ptr<TtlFileCache> bio_cache;
+    // biography downloads in flight, shared by the queries asking for them
+    mutable RequestCoalescer<std::string> bio_requests;
+    std::map<Renderer, unity::scopes::CategoryRenderer> renderers;
+
+    // maps artist to the album used for its artist art; rebuilt when the
+    // mediascanner database changes, misses are filled in one by one.
+    mutable std::mutex artist_index_mutex;
+    mutable std::unordered_map<std::string, std::string> artist_index;
+    mutable std::uint64_t artist_index_generation = 0;
+    mutable bool artist_index_valid = false;
+
+    // list of genres used for the genre departments, refreshed when the
+    // mediascanner database changes
+    mutable std::mutex genres_mutex;
+    mutable std::shared_ptr<const std::vector<std::string>> genres_cache;
+    mutable std::uint64_t genres_generation = 0;
+
+    // served as is, even when out of date; a newer one is built in the
+    // background when the mediascanner database changes
+    mutable std::mutex snapshot_mutex;
+    mutable std::shared_ptr<const SurfacingSnapshot> snapshot;
+    mutable std::thread snapshot_thread;
+    mutable bool snapshot_rebuilding = false;
+    // set by stop(), no rebuild is started afterwards
+    bool snapshot_stopping = false;
 };
 
 class MusicQuery : public unity::scopes::SearchQueryBase
@@ -41,23 +137,45 @@ public:
 
 private:
     const MusicScope &scope;
+    // connection checked out on first use, kept until the query is done
+    mutable MediaStorePool::Handle store_handle;
+    mediascanner::MediaStore const& store() const;
     std::atomic<bool> query_cancelled;
+    // honours the cardinality requested by the aggregator
+    const int max_results;
 
-    unity::scopes::CategoryRenderer make_renderer(std::string json_text, std::string const& fallback) const;
     void populate_departments(unity::scopes::SearchReplyProxy const &reply) const;
     void query_songs(unity::scopes::SearchReplyProxy const&reply, unity::scopes::Category::SCPtr const& override_category = unity::scopes::Category::SCPtr(),
             bool sortByMtime = false) const;
     void query_albums(unity::scopes::SearchReplyProxy const&reply, unity::scopes::Category::SCPtr const& override_category = unity::scopes::Category::SCPtr()) const;
     void query_genres(unity::scopes::SearchReplyProxy const&reply) const;
     void query_albums_by_genre(unity::scopes::SearchReplyProxy const &reply, const std::string& genre) const;
-    void query_albums_by_artist(unity::scopes::SearchReplyProxy const &reply, const std::string& artist) const;
+    // returns a function pushing the biography card once it is fetched
+    std::function<void()> query_albums_by_artist(unity::scopes::SearchReplyProxy const &reply, const std::string& artist) const;
     void query_songs_by_artist(unity::scopes::SearchReplyProxy const &reply, const std::string& artist) const;
     void query_artists(unity::scopes::SearchReplyProxy const& reply, unity::scopes::Category::SCPtr const& override_category = unity::scopes::Category::SCPtr()) const;
-    std::string fetch_biography_sync(const std::string& artist, const std::string &album) const;
+    void search_all(unity::scopes::SearchReplyProxy const& reply, unity::scopes::Category::SCPtr const& artists_cat,
+            unity::scopes::Category::SCPtr const& albums_cat, unity::scopes::Category::SCPtr const& songs_cat) const;
 
+    // receives the results of a lookup; returning false stops it
+    typedef std::function<bool(unity::scopes::CategorisedResult const&)> ResultSink;
+    unity::scopes::Category::SCPtr register_artists_category(unity::scopes::SearchReplyProxy const& reply) const;
+    unity::scopes::Category::SCPtr register_albums_category(unity::scopes::SearchReplyProxy const& reply) const;
+    unity::scopes::Category::SCPtr register_songs_category(unity::scopes::SearchReplyProxy const& reply) const;
+    void fetch_artists(mediascanner::MediaStore const& store, unity::scopes::Category::SCPtr const& cat, ResultSink const& sink) const;
+    void fetch_albums(mediascanner::MediaStore const& store, unity::scopes::Category::SCPtr const& cat, ResultSink const& sink) const;
+    void fetch_songs(mediascanner::MediaStore const& store, unity::scopes::Category::SCPtr const& cat, ResultSink const& sink,
+            bool sortByMtime = false) const;
+    void emit_songs(unity::scopes::Category::SCPtr const& cat, std::vector<mediascanner::MediaFile> const& songs, ResultSink const& sink) const;
+    std::string fetch_biography(const std::string& artist, const std::string &album) const;
+
+    unity::scopes::CategorisedResult create_artist_result(unity::scopes::Category::SCPtr const& category, std::string const& artist,
+            std::string const& album) const;
     unity::scopes::CategorisedResult create_album_result(unity::scopes::Category::SCPtr const& category, mediascanner::Album const& album) const;
+    // playlist is attached to the first card of playlist_id only
     unity::scopes::CategorisedResult create_song_result(unity::scopes::Category::SCPtr const& category, mediascanner::MediaFile const& media, bool audio_data =
-            false, std::vector<mediascanner::MediaFile> const& album_songs = std::vector<mediascanner::MediaFile>()) const;
+            false, std::string const& playlist_id = std::string(), unity::scopes::Variant const& playlist = unity::scopes::Variant()) const;
+    static unity::scopes::Variant make_playlist(std::vector<mediascanner::MediaFile> const& songs);
 };
 
 class MusicPreview : public unity::scopes::PreviewQueryBase
@@ -71,6 +189,7 @@ private:
     void song_preview(unity::scopes::PreviewReplyProxy const &reply) const;
     void album_preview(unity::scopes::PreviewReplyProxy const &reply) const;
     const MusicScope &scope;
+    std::atomic<bool> query_cancelled;
 };
 
 #endif
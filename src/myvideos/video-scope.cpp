@@ -19,6 +19,7 @@
 #include <config.h>
 
 #include <stdio.h>
+#include <iostream>
 
 #include <boost/regex.hpp>
 #include <mediascanner/Filter.hh>
@@ -32,9 +33,13 @@
 #include <unity/scopes/VariantBuilder.h>
 
 #include "video-scope.h"
+#include "../utils/storequery.h"
 #include "../utils/i18n.h"
+#include "../utils/trace.h"
+#include "../utils/utils.h"
 
 #define MAX_RESULTS 100
+#define STORE_POOL_SIZE 4
 
 using namespace mediascanner;
 using namespace unity::scopes;
@@ -143,11 +148,40 @@ enum class VideoType {
 
 void VideoScope::start(std::string const&) {
     init_gettext(*this);
-    store.reset(new MediaStore(MS_READ_ONLY));
+    stores.reset(new MediaStorePool(STORE_POOL_SIZE));
+
+    // renderers only depend on the scope directory, so parse them once
+    renderers = {
+        {Renderer::GetStarted, CategoryRenderer(GET_STARTED_CATEGORY_DEFINITION)},
+        {Renderer::GetStartedAggregated, CategoryRenderer(GET_STARTED_AGG_CATEGORY_DEFINITION)},
+        {Renderer::Local, make_renderer(LOCAL_CATEGORY_DEFINITION, MISSING_VIDEO_ART)},
+        {Renderer::Aggregator, make_renderer(AGGREGATOR_CATEGORY_DEFINITION, MISSING_VIDEO_ART)},
+        {Renderer::Search, make_renderer(SEARCH_CATEGORY_DEFINITION, MISSING_VIDEO_ART)},
+    };
+}
+
+CategoryRenderer VideoScope::make_renderer(std::string json_text, std::string const& fallback) const
+{
+    static std::string const placeholder("@FALLBACK@");
+    size_t pos = json_text.find(placeholder);
+    if (pos != std::string::npos)
+    {
+        json_text.replace(pos, placeholder.size(), scope_directory() + "/" + fallback);
+    }
+    return CategoryRenderer(json_text);
+}
+
+CategoryRenderer const& VideoScope::renderer(Renderer type) const
+{
+    return renderers.at(type);
 }
 
 void VideoScope::stop() {
-    store.reset();
+    if (stores)
+    {
+        std::cerr << "MediaStore pool: " << stores->stats() << std::endl;
+    }
+    stores.reset();
 }
 
 SearchQueryBase::UPtr VideoScope::search(CannedQuery const &q,
@@ -164,10 +198,13 @@ PreviewQueryBase::UPtr VideoScope::preview(Result const& result,
 
 VideoQuery::VideoQuery(VideoScope &scope, CannedQuery const& query, SearchMetadata const& hints)
     : SearchQueryBase(query, hints),
-      scope(scope) {
+      scope(scope),
+      query_cancelled(false),
+      max_results(query_result_limit(hints, MAX_RESULTS)) {
 }
 
 void VideoQuery::cancelled() {
+    query_cancelled = true;
 }
 
 static bool from_camera(const std::string &filename) {
@@ -176,15 +213,20 @@ static bool from_camera(const std::string &filename) {
 }
 
 void VideoQuery::run(SearchReplyProxy const&reply) {
+    // logs the query under the aggregator's trace id, if tracing
+    QueryTrace trace(query().scope_id(), search_metadata());
     const bool surfacing = query().query_string() == "";
     const bool is_aggregated = search_metadata().is_aggregated();
 
+    const auto store_start = QueryTrace::clock::now();
+    store = scope.stores->acquire();
     const bool empty_db = is_database_empty();
+    trace.span("store", store_start);
 
     if (empty_db)
     {
         if (!is_aggregated) {
-            const CategoryRenderer renderer(GET_STARTED_CATEGORY_DEFINITION);
+            const CategoryRenderer &renderer = scope.renderer(VideoScope::Renderer::GetStarted);
             auto cat = reply->register_category("myvideos-getstarted", "", "", renderer);
             CategorisedResult res(cat);
             res.set_uri(query().to_uri());
@@ -193,7 +235,7 @@ void VideoQuery::run(SearchReplyProxy const&reply) {
             res.set_art(scope.scope_directory() + "/" + "getstarted.svg");
             reply->push(res);
         } else if (surfacing) {
-            const CategoryRenderer renderer(GET_STARTED_AGG_CATEGORY_DEFINITION);
+            const CategoryRenderer &renderer = scope.renderer(VideoScope::Renderer::GetStartedAggregated);
             auto cat = reply->register_category("myvideos-getstarted", "", "", renderer);
             CategorisedResult res(cat);
             res.set_uri("appid://com.ubuntu.camera/camera/current-user-version");
@@ -201,6 +243,7 @@ void VideoQuery::run(SearchReplyProxy const&reply) {
             res.set_title(_("Nothing here yet...\nMake a video!"));
             reply->push(res);
         }
+        trace.finish();
         return;
     }
 
@@ -226,27 +269,31 @@ void VideoQuery::run(SearchReplyProxy const&reply) {
         cat = reply->register_category(
             "local", _("My Videos"), LOCAL_CATEGORY_ICON,
             CannedQuery(query().scope_id(), query().query_string(), ""),
-            make_renderer(surfacing ? AGGREGATOR_CATEGORY_DEFINITION : SEARCH_CATEGORY_DEFINITION, MISSING_VIDEO_ART));
+            scope.renderer(surfacing ? VideoScope::Renderer::Aggregator : VideoScope::Renderer::Search));
     } else {
         cat = reply->register_category(
             "local", _("My Videos"), LOCAL_CATEGORY_ICON,
-            make_renderer(surfacing ? LOCAL_CATEGORY_DEFINITION : SEARCH_CATEGORY_DEFINITION, MISSING_VIDEO_ART));
+            scope.renderer(surfacing ? VideoScope::Renderer::Local : VideoScope::Renderer::Search));
     }
-    mediascanner::Filter filter;
-    filter.setLimit(MAX_RESULTS);
-    for (const auto &media : scope.store->query(query().query_string(), VideoMedia, filter)) {
+    // departments filter the results after the fact, so only the
+    // unfiltered view can push the cardinality down into the store query
+    int remaining = max_results;
+    auto const query_string = query().query_string();
+    for_each_row(query_cancelled, mediascanner::Filter(), department == VideoType::ALL ? max_results : MAX_RESULTS,
+            [this, &query_string](mediascanner::Filter const& f) { return store->query(query_string, VideoMedia, f); },
+            [&reply, &cat, &remaining, department](MediaFile const& media) -> bool {
         // Filter results if we are in a department
         switch (department) {
         case VideoType::ALL:
             break;
         case VideoType::CAMERA:
             if (!from_camera(media.getFileName())) {
-                continue;
+                return true;
             }
             break;
         case VideoType::DOWNLOADS:
             if (from_camera(media.getFileName())) {
-                continue;
+                return true;
             }
             break;
         }
@@ -263,38 +310,27 @@ void VideoQuery::run(SearchReplyProxy const&reply) {
         // res["width"] = media.getWidth();
         // res["height"] = media.getHeight();
 
-        if(!reply->push(res))
-        {
-            return;
-        }
-    }
+        return reply->push(res) && --remaining > 0;
+    });
+    trace.finish();
 }
 
 bool VideoQuery::is_database_empty() const
 {
     mediascanner::Filter filter;
     filter.setLimit(1);
-    return scope.store->query("", VideoMedia, filter).size() == 0;
-}
-
-CategoryRenderer VideoQuery::make_renderer(std::string json_text, std::string const& fallback) const
-{
-    static std::string const placeholder("@FALLBACK@");
-    size_t pos = json_text.find(placeholder);
-    if (pos != std::string::npos)
-    {
-        json_text.replace(pos, placeholder.size(), scope.scope_directory() + "/" + fallback);
-    }
-    return CategoryRenderer(json_text);
+    return store->query("", VideoMedia, filter).size() == 0;
 }
 
 
 VideoPreview::VideoPreview(VideoScope &scope, Result const& result, ActionMetadata const& hints)
     : PreviewQueryBase(result, hints),
-      scope(scope) {
+      scope(scope),
+      query_cancelled(false) {
 }
 
 void VideoPreview::cancelled() {
+    query_cancelled = true;
 }
 
 void VideoPreview::run(PreviewReplyProxy const& reply)
@@ -338,6 +374,10 @@ void VideoPreview::run(PreviewReplyProxy const& reply)
         actions.add_attribute_value("actions", builder.end());
     }
 
+    if (query_cancelled)
+    {
+        return;
+    }
     reply->push({video, header, actions});
 }
 
@@ -1,13 +1,18 @@
 #ifndef VIDEO_SCOPE_H
 #define VIDEO_SCOPE_H
 
+#include <atomic>
+#include <map>
 #include <memory>
 
 #include <mediascanner/MediaStore.hh>
+#include <unity/scopes/CategoryRenderer.h>
 #include <unity/scopes/SearchReply.h>
 #include <unity/scopes/ScopeBase.h>
 #include <unity/scopes/Variant.h>
 
+#include "../utils/mediastorepool.h"
+
 class VideoScope : public unity::scopes::ScopeBase
 {
     friend class VideoQuery;
@@ -19,7 +24,20 @@ public:
     virtual unity::scopes::PreviewQueryBase::UPtr preview(unity::scopes::Result const& result, unity::scopes::ActionMetadata const& hints) override;
 
 private:
-    std::unique_ptr<mediascanner::MediaStore> store;
+    enum class Renderer {
+        GetStarted,
+        GetStartedAggregated,
+        Local,
+        Aggregator,
+        Search,
+    };
+
+    unity::scopes::CategoryRenderer make_renderer(std::string json_text, std::string const& fallback) const;
+    unity::scopes::CategoryRenderer const& renderer(Renderer type) const;
+
+    // read-only connections shared by all queries
+    std::unique_ptr<MediaStorePool> stores;
+    std::map<Renderer, unity::scopes::CategoryRenderer> renderers;
 };
 
 class VideoQuery : public unity::scopes::SearchQueryBase
@@ -31,8 +49,12 @@ public:
     bool is_database_empty() const;
 
 private:
-    unity::scopes::CategoryRenderer make_renderer(std::string json_text, std::string const& fallback) const;
     const VideoScope &scope;
+    // connection checked out for the duration of run()
+    MediaStorePool::Handle store;
+    std::atomic<bool> query_cancelled;
+    // honours the cardinality requested by the aggregator
+    const int max_results;
 };
 
 class VideoPreview : public unity::scopes::PreviewQueryBase
@@ -44,6 +66,7 @@ public:
 
 private:
     const VideoScope &scope;
+    std::atomic<bool> query_cancelled;
 };
 
 #endif
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "aggregatorchildsearches.h"
+#include "bufferedresultforwarder.h"
+#include "sharedsearch.h"
+
+#include <unity/scopes/QueryCtrl.h>
+
+#include <iostream>
+
+using namespace unity::scopes;
+
+// how long an identical query waits for the search it shares; it then
+// gets what has been received so far. Its run() only waits for the
+// search to be dispatched.
+static const std::chrono::milliseconds SHARED_SEARCH_TIMEOUT(3000);
+
+// the query trace, which ends once every child search has finished
+struct AggregatorChildSearches::Trace
+{
+    Trace(std::string const& scope_id, SearchMetadata const& metadata)
+        : query(scope_id, metadata)
+    {
+    }
+
+    void child_finished()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running--;
+            if (!all_dispatched || running > 0)
+            {
+                return;
+            }
+        }
+        query.finish();
+    }
+
+    void dispatched()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            all_dispatched = true;
+            if (running > 0)
+            {
+                return;
+            }
+        }
+        query.finish();
+    }
+
+    QueryTrace query;
+    std::mutex mutex;
+    unsigned lanes = 0;
+    unsigned running = 0;
+    bool all_dispatched = false;
+};
+
+// the timings of a child search, as of when it finished once its forwarder is gone
+struct AggregatorChildSearches::DispatchedChild
+{
+    DispatchedChild(std::string const& child_id, std::shared_ptr<BufferedResultForwarder> const& forwarder)
+        : child_id(child_id),
+          forwarder(forwarder),
+          timings(forwarder->timings())
+    {
+    }
+
+    BufferedResultForwarder::Timings get_timings()
+    {
+        auto const live = forwarder.lock();
+        if (live)
+        {
+            return live->timings();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        return timings;
+    }
+
+    const std::string child_id;
+    const std::weak_ptr<BufferedResultForwarder> forwarder;
+    std::mutex mutex;
+    BufferedResultForwarder::Timings timings;
+};
+
+AggregatorChildSearches::AggregatorChildSearches(CannedQuery const& query, SearchMetadata const& metadata,
+        std::shared_ptr<SearchCoalescer> const& coalescer)
+    : query_string_(query.query_string()),
+      query_(query),
+      metadata_(metadata),
+      coalescer_(coalescer),
+      cancelled_(false),
+      trace_(std::make_shared<Trace>(query.scope_id(), metadata))
+{
+}
+
+AggregatorChildSearches::~AggregatorChildSearches()
+{
+    if (child_stats_logging())
+    {
+        for (auto const& child: stats())
+        {
+            std::cerr << "Query '" << query_string_ << "' " << child << std::endl;
+        }
+    }
+}
+
+void AggregatorChildSearches::start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    started_ = std::chrono::steady_clock::now();
+}
+
+void AggregatorChildSearches::cancel()
+{
+    std::vector<QueryCtrlProxy> searches;
+    std::vector<std::shared_ptr<BufferedResultForwarder>> forwarders;
+    std::shared_ptr<SharedSearch> shared;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cancelled_ = true;
+        searches.swap(searches_);
+        forwarders.swap(forwarders_);
+        shared.swap(shared_search_);
+    }
+    // identical queries waiting for this one have to search on their own
+    if (shared)
+    {
+        shared->abandon();
+    }
+    // stop forwarding first, so that nothing more reaches the reply
+    for (auto const& forwarder: forwarders)
+    {
+        forwarder->cancel();
+    }
+    for (auto const& search: searches)
+    {
+        search->cancel();
+    }
+}
+
+bool AggregatorChildSearches::cancelled() const
+{
+    return cancelled_;
+}
+
+bool AggregatorChildSearches::follow_shared_search(SearchReplyProxy const& reply, ChildScopeList const& children,
+        bool cacheable, std::shared_ptr<SharedSearch>& recording, std::function<void()> const& search_on_own)
+{
+    if (!coalescer_)
+    {
+        return false;
+    }
+    bool leader = false;
+    auto shared = coalescer_->join(shared_search_key(query_, metadata_, children), cacheable, leader);
+    if (leader)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cancelled_)
+        {
+            shared->abandon();
+            return true;
+        }
+        shared_search_ = shared;
+        recording = shared;
+        return false;
+    }
+    if (shared->follow(reply, cancelled_, SHARED_SEARCH_TIMEOUT, search_on_own))
+    {
+        return true;
+    }
+    // unless cancelled, the leader gave up and this query has to search on its own
+    return cancelled_;
+}
+
+void AggregatorChildSearches::dispatching(std::string const& child_id, SearchMetadata& metadata,
+        std::shared_ptr<BufferedResultForwarder> const& forwarder)
+{
+    trace_->query.propagate(metadata);
+    forwarder->mark_dispatched();
+    auto const dispatched = std::make_shared<DispatchedChild>(child_id, forwarder);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        dispatched_.push_back(dispatched);
+    }
+    auto const child = forwarder.get();
+    forwarder->add_finished_callback([dispatched, child](CompletionDetails const&) {
+            auto const timings = child->timings();
+            std::lock_guard<std::mutex> lock(dispatched->mutex);
+            dispatched->timings = timings;
+        });
+    if (!trace_->query.enabled())
+    {
+        return;
+    }
+    unsigned lane;
+    {
+        std::lock_guard<std::mutex> lock(trace_->mutex);
+        lane = ++trace_->lanes;
+        trace_->running++;
+    }
+    // traced once it has finished; a child that never does gets no span
+    auto const trace = trace_;
+    forwarder->add_finished_callback([trace, child_id, lane, child](CompletionDetails const&) {
+            auto const timings = child->timings();
+            trace->query.span(child_id, timings.dispatched, timings.finished, lane);
+            if (timings.first_result != QueryTrace::clock::time_point())
+            {
+                trace->query.span(child_id + " first result", timings.dispatched, timings.first_result, lane);
+            }
+            trace->child_finished();
+        });
+}
+
+void AggregatorChildSearches::track(QueryCtrlProxy const& ctrl,
+        std::shared_ptr<BufferedResultForwarder> const& forwarder)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!cancelled_)
+        {
+            if (ctrl)
+            {
+                searches_.push_back(ctrl);
+            }
+            forwarders_.push_back(forwarder);
+            return;
+        }
+    }
+    // cancelled while the searches were being dispatched
+    forwarder->cancel();
+    if (ctrl)
+    {
+        ctrl->cancel();
+    }
+}
+
+void AggregatorChildSearches::dispatched()
+{
+    trace_->dispatched();
+}
+
+std::vector<ChildSearchStats> AggregatorChildSearches::stats()
+{
+    std::vector<std::shared_ptr<DispatchedChild>> dispatched;
+    std::chrono::steady_clock::time_point started;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        dispatched = dispatched_;
+        started = started_;
+    }
+    // the forwarders are chained from the last child shown to the first
+    ChildTimingsList children;
+    for (auto it = dispatched.rbegin(); it != dispatched.rend(); ++it)
+    {
+        children.emplace_back((*it)->child_id, (*it)->get_timings());
+    }
+    return child_search_stats(started, children);
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MEDIASCANNER_SCOPE_AGGREGATORCHILDSEARCHES_H
+#define MEDIASCANNER_SCOPE_AGGREGATORCHILDSEARCHES_H
+
+#include <unity/scopes/CannedQuery.h>
+#include <unity/scopes/ChildScope.h>
+#include <unity/scopes/QueryCtrlProxyFwd.h>
+#include <unity/scopes/ReplyProxyFwd.h>
+#include <unity/scopes/SearchMetadata.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "childstats.h"
+#include "trace.h"
+
+class BufferedResultForwarder;
+class SearchCoalescer;
+class SharedSearch;
+
+/*
+   The child searches of an aggregator query. They are cancelled along
+   with the query, shared with identical queries when there is a
+   coalescer, traced as they finish, and their timings logged once the
+   query is done with them. Both aggregator queries own one.
+*/
+class AggregatorChildSearches
+{
+public:
+    // coalescer is shared by the queries of the scope and may be null
+    AggregatorChildSearches(unity::scopes::CannedQuery const& query, unity::scopes::SearchMetadata const& metadata,
+            std::shared_ptr<SearchCoalescer> const& coalescer);
+    // logs the stats of every child search
+    ~AggregatorChildSearches();
+
+    AggregatorChildSearches(AggregatorChildSearches const&) = delete;
+    AggregatorChildSearches& operator=(AggregatorChildSearches const&) = delete;
+
+    // call it when the query starts running
+    void start();
+    // cancels the searches dispatched so far, and any dispatched later
+    void cancel();
+    bool cancelled() const;
+
+    /*
+       Returns true if the query is answered by an identical one (or was
+       cancelled meanwhile); should that one be cancelled before it has
+       completed, search_on_own is called later on. Otherwise recording
+       is set if identical queries may follow this one.
+    */
+    bool follow_shared_search(unity::scopes::SearchReplyProxy const& reply, unity::scopes::ChildScopeList const& children,
+            bool cacheable, std::shared_ptr<SharedSearch>& recording, std::function<void()> const& search_on_own);
+
+    // adds the trace hints to the metadata of the child search and marks
+    // the forwarder dispatched; call it right before dispatching
+    void dispatching(std::string const& child_id, unity::scopes::SearchMetadata& metadata,
+            std::shared_ptr<BufferedResultForwarder> const& forwarder);
+    // the search is cancelled with the query (right away if it already was)
+    void track(unity::scopes::QueryCtrlProxy const& ctrl,
+            std::shared_ptr<BufferedResultForwarder> const& forwarder);
+    // every child search has been dispatched (or the query gave up): the
+    // query is traced as complete once they have all finished
+    void dispatched();
+
+    // per child timings, in the order the children are shown
+    std::vector<ChildSearchStats> stats();
+
+private:
+    const std::string query_string_;
+    const unity::scopes::CannedQuery query_;
+    const unity::scopes::SearchMetadata metadata_;
+    const std::shared_ptr<SearchCoalescer> coalescer_;
+
+    std::mutex mutex_;
+    std::atomic<bool> cancelled_;
+    // recording of this query's search, when identical queries may follow it
+    std::shared_ptr<SharedSearch> shared_search_;
+    // searches in flight
+    std::vector<unity::scopes::QueryCtrlProxy> searches_;
+    std::vector<std::shared_ptr<BufferedResultForwarder>> forwarders_;
+
+    std::chrono::steady_clock::time_point started_;
+    struct DispatchedChild;
+    // every child search, in dispatch order; kept for the stats without
+    // keeping the forwarders (and their buffers) alive
+    std::vector<std::shared_ptr<DispatchedChild>> dispatched_;
+
+    struct Trace;
+    // shared with the forwarders, whose searches may finish once the query is gone
+    const std::shared_ptr<Trace> trace_;
+};
+
+#endif
@@ -19,18 +19,188 @@
 
 #include "bufferedresultforwarder.h"
 
+#include <utility>
+
+BufferedResultForwarder::BufferedResultForwarder(unity::scopes::SearchReplyProxy const& upstream,
+        unity::scopes::utility::BufferedResultForwarder::SPtr const& next_forwarder)
+    : BufferedResultForwarder(upstream, next_forwarder, nullptr)
+{
+}
+
 BufferedResultForwarder::BufferedResultForwarder(unity::scopes::SearchReplyProxy const& upstream,
         unity::scopes::utility::BufferedResultForwarder::SPtr const& next_forwarder,
         std::function<bool(unity::scopes::CategorisedResult&)> const &result_filter)
     : unity::scopes::utility::BufferedResultForwarder(upstream, next_forwarder),
-      result_filter_(result_filter)
+      result_filter_(result_filter),
+      deadline_expired_(false),
+      cancelled_(false),
+      dropped_(0),
+      received_(0),
+      filtered_(0)
+{
+    auto const next = std::dynamic_pointer_cast<BufferedResultForwarder>(next_forwarder);
+    chain_mutex_ = next ? next->chain_mutex_ : std::make_shared<std::recursive_mutex>();
+}
+
+BufferedResultForwarder::~BufferedResultForwarder()
+{
+    stop_deadline();
+}
+
+void BufferedResultForwarder::set_deadline(std::chrono::milliseconds timeout, LateResults policy)
+{
+    late_results_ = policy;
+    deadline_id_ = DeadlineTimer::instance().schedule(std::chrono::steady_clock::now() + timeout,
+            [this]() { expire_deadline(); });
+}
+
+void BufferedResultForwarder::expire_deadline()
+{
+    std::lock_guard<std::recursive_mutex> lock(*chain_mutex_);
+    deadline_expired_ = true;
+    {
+        std::lock_guard<std::mutex> timings_lock(timings_mutex_);
+        deadline_expired_at_ = std::chrono::steady_clock::now();
+    }
+    set_ready();
+}
+
+void BufferedResultForwarder::stop_deadline()
 {
+    if (deadline_id_ != 0)
+    {
+        DeadlineTimer::instance().cancel(deadline_id_);
+    }
+}
+
+bool BufferedResultForwarder::deadline_expired() const
+{
+    return deadline_expired_;
+}
+
+void BufferedResultForwarder::cancel()
+{
+    cancelled_ = true;
+    stop_deadline();
+    // the base class only lets go of its buffer once the forwarder is
+    // ready; the reply has been cancelled along with the query, so the
+    // results buffered so far are discarded rather than shown
+    std::lock_guard<std::recursive_mutex> lock(*chain_mutex_);
+    set_ready();
+}
+
+void BufferedResultForwarder::set_result_limit(unsigned limit)
+{
+    result_limit_ = limit;
+}
+
+unsigned BufferedResultForwarder::dropped_results() const
+{
+    return dropped_;
+}
+
+void BufferedResultForwarder::add_finished_callback(std::function<void(unity::scopes::CompletionDetails const&)> const& callback)
+{
+    finished_callbacks_.push_back(callback);
+}
+
+void BufferedResultForwarder::set_result_observer(std::function<void(unity::scopes::CategorisedResult const&)> const& observer)
+{
+    result_observer_ = observer;
+}
+
+void BufferedResultForwarder::mark_dispatched()
+{
+    std::lock_guard<std::mutex> lock(timings_mutex_);
+    dispatched_at_ = std::chrono::steady_clock::now();
+}
+
+BufferedResultForwarder::Timings BufferedResultForwarder::timings() const
+{
+    Timings timings;
+    {
+        std::lock_guard<std::mutex> lock(timings_mutex_);
+        timings.dispatched = dispatched_at_;
+        timings.first_result = first_result_at_;
+        timings.deadline_expired = deadline_expired_at_;
+        timings.finished = finished_at_;
+    }
+    timings.received = received_;
+    timings.filtered = filtered_;
+    timings.dropped = dropped_;
+    return timings;
 }
 
 void BufferedResultForwarder::push(unity::scopes::CategorisedResult result)
 {
-    if (result_filter_(result))
+    if (receive())
+    {
+        if (filter(result))
+        {
+            forward(std::move(result));
+        }
+        else
+        {
+            filtered_out();
+        }
+    }
+}
+
+bool BufferedResultForwarder::accepting() const
+{
+    return !cancelled_ && !(deadline_expired_ && late_results_ == LateResults::Drop);
+}
+
+bool BufferedResultForwarder::receive()
+{
+    if (received_++ == 0)
+    {
+        std::lock_guard<std::mutex> lock(timings_mutex_);
+        first_result_at_ = std::chrono::steady_clock::now();
+    }
+    return accepting();
+}
+
+void BufferedResultForwarder::filtered_out()
+{
+    filtered_++;
+}
+
+void BufferedResultForwarder::forward(unity::scopes::CategorisedResult&& result)
+{
+    // results of one child arrive serially, so forwarded_ needs no locking
+    if (result_limit_ > 0 && forwarded_ >= result_limit_)
+    {
+        dropped_++;
+        return;
+    }
+    forwarded_++;
+    if (result_observer_)
+    {
+        result_observer_(result);
+    }
+    std::lock_guard<std::recursive_mutex> lock(*chain_mutex_);
+    unity::scopes::utility::BufferedResultForwarder::push(std::move(result));
+}
+
+bool BufferedResultForwarder::filter(unity::scopes::CategorisedResult& result)
+{
+    return !result_filter_ || result_filter_(result);
+}
+
+void BufferedResultForwarder::finished(unity::scopes::CompletionDetails const& details)
+{
+    // a deadline expiring now has set the forwarder ready by the time
+    // this returns, otherwise it won't expire at all
+    stop_deadline();
+    {
+        std::lock_guard<std::mutex> lock(timings_mutex_);
+        finished_at_ = std::chrono::steady_clock::now();
+    }
+    for (auto const& callback: finished_callbacks_)
     {
-        unity::scopes::utility::BufferedResultForwarder::push(result);
+        callback(details);
     }
+    std::lock_guard<std::recursive_mutex> lock(*chain_mutex_);
+    unity::scopes::utility::BufferedResultForwarder::finished(details);
 }
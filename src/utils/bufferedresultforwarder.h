@@ -21,24 +21,133 @@
 #define BUFFEREDRESULTFORWARDER_H_
 
 #include <unity/scopes/CategorisedResult.h>
+#include <unity/scopes/CompletionDetails.h>
 #include <unity/scopes/utility/BufferedResultForwarder.h>
 
+#include "deadlinetimer.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 /*
    ResultForwarder that buffers results up until it gets
    notified via on_forwarder_ready() by another ResultForwarder.
+
+   With a deadline, the forwarder stops waiting for its child scope when
+   the deadline passes: it marks itself ready, so that its buffered
+   results are flushed and the forwarders after it are no longer held
+   up. Results arriving after that are appended or dropped. Deadlines are
+   kept by the process-wide DeadlineTimer, not by a thread per forwarder.
 */
 class BufferedResultForwarder : public unity::scopes::utility::BufferedResultForwarder
 {
 public:
+    enum class LateResults
+    {
+        Append,
+        Drop,
+    };
+
+    // time points are left at the clock's epoch until they happen
+    struct Timings
+    {
+        std::chrono::steady_clock::time_point dispatched;
+        std::chrono::steady_clock::time_point first_result;
+        std::chrono::steady_clock::time_point deadline_expired;
+        std::chrono::steady_clock::time_point finished;
+        unsigned received = 0;
+        // rejected by the filter
+        unsigned filtered = 0;
+        // over the result limit
+        unsigned dropped = 0;
+    };
 
+    // forwards every result, unless a subclass overrides filter()
+    BufferedResultForwarder(unity::scopes::SearchReplyProxy const& upstream,
+            unity::scopes::utility::BufferedResultForwarder::SPtr const& next_forwarder);
     BufferedResultForwarder(unity::scopes::SearchReplyProxy const& upstream,
             unity::scopes::utility::BufferedResultForwarder::SPtr const& next_forwarder,
-            std::function<bool(unity::scopes::CategorisedResult&)> const &result_filter = [](unity::scopes::CategorisedResult&) -> bool { return true; });
+            std::function<bool(unity::scopes::CategorisedResult&)> const &result_filter);
+    ~BufferedResultForwarder();
+
+    // starts counting from now; call it once, right before dispatching the search
+    void set_deadline(std::chrono::milliseconds timeout, LateResults policy = LateResults::Append);
+    bool deadline_expired() const;
+    // stops the deadline timer, releases the buffered results and drops
+    // every result from now on
+    void cancel();
+    // forwards (and buffers) at most limit results, dropping the rest; 0 means no limit
+    void set_result_limit(unsigned limit);
+    // results dropped because the limit was reached
+    unsigned dropped_results() const;
+    // called from finished(), once the child has completed its search;
+    // set them up before dispatching the search
+    void add_finished_callback(std::function<void(unity::scopes::CompletionDetails const&)> const& callback);
+    // sees every result that is forwarded (or buffered)
+    void set_result_observer(std::function<void(unity::scopes::CategorisedResult const&)> const& observer);
+    // call it right before dispatching the search
+    void mark_dispatched();
+    Timings timings() const;
 
     virtual void push(unity::scopes::CategorisedResult result) override;
+    virtual void finished(unity::scopes::CompletionDetails const& details) override;
+
+protected:
+    // decides whether a result is forwarded, possibly updating it first
+    virtual bool filter(unity::scopes::CategorisedResult& result);
+    // false once cancelled, or past the deadline when late results are dropped
+    bool accepting() const;
+    // counts an incoming result, and returns whether it's accepted
+    bool receive();
+    void filtered_out();
+    // hands the result on (or buffers it) without copying it
+    void forward(unity::scopes::CategorisedResult&& result);
 
 private:
+    // run by the timer when the deadline passes
+    void expire_deadline();
+    // once this returns the deadline can't expire any more
+    void stop_deadline();
+
+    // empty when there is no filter
     const std::function<bool(unity::scopes::CategorisedResult&)> result_filter_;
+
+    /*
+       Shared by all the forwarders of a chain (it is taken from the next
+       forwarder), it serializes every call into the base class: push()
+       from the middleware threads, set_ready() from the timer and
+       finished(). The base class notifies the next forwarder
+       (on_forwarder_ready()) from within set_ready() and finished(), so
+       that is serialized with the next forwarder's pushes as well. It is
+       recursive because those notifications run with it held.
+    */
+    std::shared_ptr<std::recursive_mutex> chain_mutex_;
+
+    // set before the search is dispatched, 0 without a deadline
+    DeadlineTimer::Id deadline_id_ = 0;
+    std::atomic<bool> deadline_expired_;
+    std::atomic<bool> cancelled_;
+    LateResults late_results_ = LateResults::Append;
+
+    std::vector<std::function<void(unity::scopes::CompletionDetails const&)>> finished_callbacks_;
+    std::function<void(unity::scopes::CategorisedResult const&)> result_observer_;
+
+    unsigned result_limit_ = 0;
+    unsigned forwarded_ = 0;
+    std::atomic<unsigned> dropped_;
+
+    // the counters are only updated by the child's (serial) pushes
+    mutable std::mutex timings_mutex_;
+    std::chrono::steady_clock::time_point dispatched_at_;
+    std::chrono::steady_clock::time_point first_result_at_;
+    std::chrono::steady_clock::time_point deadline_expired_at_;
+    std::chrono::steady_clock::time_point finished_at_;
+    std::atomic<unsigned> received_;
+    std::atomic<unsigned> filtered_;
 };
 
 #endif
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "cachefile.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static std::runtime_error system_error(std::string const& what, std::string const& path)
+{
+    return std::runtime_error(what + " " + path + ": " + strerror(errno));
+}
+
+void CacheFileWriter::put_u32(std::uint32_t value)
+{
+    data_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void CacheFileWriter::put_u64(std::uint64_t value)
+{
+    data_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void CacheFileWriter::put_string(std::string const& value)
+{
+    put_u32(value.size());
+    data_.append(value);
+}
+
+void CacheFileWriter::save(std::string const& path) const
+{
+    const std::string tmp_path = path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        throw system_error("Cannot create", tmp_path);
+    }
+
+    std::size_t written = 0;
+    while (written < data_.size())
+    {
+        ssize_t n = ::write(fd, data_.data() + written, data_.size() - written);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            auto const error = system_error("Cannot write", tmp_path);
+            ::close(fd);
+            ::unlink(tmp_path.c_str());
+            throw error;
+        }
+        written += n;
+    }
+    if (::close(fd) != 0 || ::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        auto const error = system_error("Cannot save", path);
+        ::unlink(tmp_path.c_str());
+        throw error;
+    }
+}
+
+CacheFileReader::~CacheFileReader()
+{
+    if (data_)
+    {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+}
+
+bool CacheFileReader::open(std::string const& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (errno == ENOENT)
+        {
+            return false;
+        }
+        throw system_error("Cannot open", path);
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        auto const error = system_error("Cannot stat", path);
+        ::close(fd);
+        throw error;
+    }
+    if (st.st_size == 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Empty cache file " + path);
+    }
+
+    void *addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        auto const error = system_error("Cannot map", path);
+        ::close(fd);
+        throw error;
+    }
+    // the mapping stays valid once the descriptor is closed
+    ::close(fd);
+    data_ = static_cast<const char*>(addr);
+    size_ = st.st_size;
+    pos_ = 0;
+    return true;
+}
+
+void CacheFileReader::read(void *dest, std::size_t size)
+{
+    if (size > size_ - pos_)
+    {
+        throw std::runtime_error("Truncated cache file");
+    }
+    std::memcpy(dest, data_ + pos_, size);
+    pos_ += size;
+}
+
+std::uint32_t CacheFileReader::get_u32()
+{
+    std::uint32_t value;
+    read(&value, sizeof(value));
+    return value;
+}
+
+std::uint64_t CacheFileReader::get_u64()
+{
+    std::uint64_t value;
+    read(&value, sizeof(value));
+    return value;
+}
+
+std::string CacheFileReader::get_string()
+{
+    const std::uint32_t size = get_u32();
+    if (size > size_ - pos_)
+    {
+        throw std::runtime_error("Truncated cache file");
+    }
+    std::string value(data_ + pos_, size);
+    pos_ += size;
+    return value;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MEDIASCANNER_SCOPE_CACHEFILE_H
+#define MEDIASCANNER_SCOPE_CACHEFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+   Minimal binary format for the caches a scope keeps between runs:
+   fixed size integers in host byte order and length-prefixed strings.
+   The files never leave the device, so no attempt is made at
+   portability; readers are expected to check a magic number and
+   version written by the caller. Errors are reported with
+   std::runtime_error.
+*/
+class CacheFileWriter
+{
+public:
+    void put_u32(std::uint32_t value);
+    void put_u64(std::uint64_t value);
+    void put_string(std::string const& value);
+
+    // replaces the file atomically, so readers never see a partial one
+    void save(std::string const& path) const;
+
+private:
+    std::string data_;
+};
+
+class CacheFileReader
+{
+public:
+    CacheFileReader() = default;
+    ~CacheFileReader();
+    CacheFileReader(CacheFileReader const&) = delete;
+    CacheFileReader& operator=(CacheFileReader const&) = delete;
+
+    // maps the file in memory; returns false if it doesn't exist
+    bool open(std::string const& path);
+
+    std::uint32_t get_u32();
+    std::uint64_t get_u64();
+    std::string get_string();
+
+private:
+    void read(void *dest, std::size_t size);
+
+    const char *data_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t pos_ = 0;
+};
+
+#endif
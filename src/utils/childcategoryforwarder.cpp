@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "childcategoryforwarder.h"
+
+ChildCategoryForwarder::ChildCategoryForwarder(unity::scopes::SearchReplyProxy const& upstream,
+        unity::scopes::utility::BufferedResultForwarder::SPtr const& next_forwarder,
+        CategoryFactory const& register_category)
+    : BufferedResultForwarder(upstream, next_forwarder),
+      register_category_(register_category)
+{
+}
+
+bool ChildCategoryForwarder::filter(unity::scopes::CategorisedResult& result)
+{
+    if (!category_)
+    {
+        category_ = register_category_(result);
+        source_category_id_ = result.category()->id();
+    }
+    else if (result.category()->id() != source_category_id_)
+    {
+        return false;
+    }
+    result.set_category(category_);
+    return true;
+}
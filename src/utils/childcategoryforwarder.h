@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MEDIASCANNER_SCOPE_CHILDCATEGORYFORWARDER_H
+#define MEDIASCANNER_SCOPE_CHILDCATEGORYFORWARDER_H
+
+#include "bufferedresultforwarder.h"
+
+#include <unity/scopes/Category.h>
+
+#include <functional>
+#include <string>
+
+/*
+   Forwarder for a child scope whose results all go to a single category
+   of the aggregator. The category is registered when the first result
+   arrives; results from other categories of the child (i.e. the child
+   is misbehaving when aggregated) are dropped.
+
+   The middleware delivers the results of one search serially, so this
+   state needs no locking.
+*/
+class ChildCategoryForwarder : public BufferedResultForwarder
+{
+public:
+    // registers the aggregator category, given the first result of the child
+    typedef std::function<unity::scopes::Category::SCPtr(unity::scopes::CategorisedResult const&)> CategoryFactory;
+
+    ChildCategoryForwarder(unity::scopes::SearchReplyProxy const& upstream,
+            unity::scopes::utility::BufferedResultForwarder::SPtr const& next_forwarder,
+            CategoryFactory const& register_category);
+
+protected:
+    virtual bool filter(unity::scopes::CategorisedResult& result) override;
+
+private:
+    const CategoryFactory register_category_;
+    unity::scopes::Category::SCPtr category_;
+    std::string source_category_id_;
+};
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "childhealth.h"
+#include "bufferedresultforwarder.h"
+
+// weight of the latest search in the moving averages
+static const double AVERAGE_WEIGHT = 0.2;
+// share of the deadline given to children that are usually later than it
+static const int SLOW_CHILD_DEADLINE_DIVISOR = 2;
+
+ChildHealthTracker::ChildHealthTracker(unsigned failure_threshold, std::chrono::milliseconds cooldown)
+    : failure_threshold_(failure_threshold),
+      cooldown_(cooldown)
+{
+}
+
+bool ChildHealthTracker::should_search(std::string const& child_id)
+{
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    Health &health = children_[child_id];
+    switch (health.circuit)
+    {
+    case Circuit::Closed:
+        return true;
+    case Circuit::Open:
+        if (now >= health.since)
+        {
+            health.circuit = Circuit::Probing;
+            health.since = now;
+            return true;
+        }
+        break;
+    case Circuit::Probing:
+        // only one probe at a time, unless it never reported back
+        if (now - health.since >= cooldown_)
+        {
+            health.since = now;
+            return true;
+        }
+        break;
+    }
+    health.stats.skipped++;
+    return false;
+}
+
+void ChildHealthTracker::record(std::string const& child_id, std::chrono::milliseconds latency, bool failed)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Health &health = children_[child_id];
+    Stats &stats = health.stats;
+    if (stats.searches == 0)
+    {
+        stats.latency_ms = latency.count();
+    }
+    else
+    {
+        stats.latency_ms += AVERAGE_WEIGHT * (latency.count() - stats.latency_ms);
+    }
+    stats.error_rate += AVERAGE_WEIGHT * ((failed ? 1.0 : 0.0) - stats.error_rate);
+    stats.searches++;
+
+    if (!failed)
+    {
+        stats.consecutive_failures = 0;
+        health.circuit = Circuit::Closed;
+    }
+    else
+    {
+        stats.failures++;
+        stats.consecutive_failures++;
+        if (health.circuit == Circuit::Probing || stats.consecutive_failures >= failure_threshold_)
+        {
+            health.circuit = Circuit::Open;
+            health.since = std::chrono::steady_clock::now() + cooldown_;
+        }
+    }
+    stats.skipping = (health.circuit != Circuit::Closed);
+}
+
+void ChildHealthTracker::record_cancelled(std::string const& child_id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = children_.find(child_id);
+    // a cancelled probe doesn't tell whether the child is back, so wait
+    // for another cooldown rather than probing on every query
+    if (it != children_.end() && it->second.circuit == Circuit::Probing)
+    {
+        it->second.circuit = Circuit::Open;
+        it->second.since = std::chrono::steady_clock::now() + cooldown_;
+    }
+}
+
+std::chrono::milliseconds ChildHealthTracker::deadline(std::string const& child_id, std::chrono::milliseconds deadline) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = children_.find(child_id);
+    if (it != children_.end() && it->second.stats.searches > 0 && it->second.stats.latency_ms > deadline.count())
+    {
+        return deadline / SLOW_CHILD_DEADLINE_DIVISOR;
+    }
+    return deadline;
+}
+
+ChildHealthTracker::Stats ChildHealthTracker::stats(std::string const& child_id) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = children_.find(child_id);
+    if (it == children_.end())
+    {
+        return Stats();
+    }
+    return it->second.stats;
+}
+
+void ChildHealthTracker::dump(std::ostream& out) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto const& child: children_)
+    {
+        Stats const& stats = child.second.stats;
+        out << child.first << ": searches=" << stats.searches
+            << " failures=" << stats.failures
+            << " skipped=" << stats.skipped
+            << " latency=" << stats.latency_ms << "ms"
+            << " error_rate=" << stats.error_rate
+            << (stats.skipping ? " (skipping)" : "") << std::endl;
+    }
+}
+
+void watch_child_health(std::shared_ptr<ChildHealthTracker> const& tracker, std::string const& child_id,
+        BufferedResultForwarder& forwarder)
+{
+    const auto dispatched = std::chrono::steady_clock::now();
+    // the callback is owned by the forwarder, so it can't outlive it
+    BufferedResultForwarder *watched = &forwarder;
+    forwarder.add_finished_callback([tracker, child_id, dispatched, watched](unity::scopes::CompletionDetails const& details) {
+            const bool cancelled = details.status() == unity::scopes::CompletionDetails::Cancelled;
+            if (cancelled && !watched->deadline_expired())
+            {
+                tracker->record_cancelled(child_id);
+                return;
+            }
+            // late children are only slow, unless they never finished at all
+            const auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - dispatched);
+            tracker->record(child_id, latency, cancelled || details.status() == unity::scopes::CompletionDetails::Error);
+        });
+}
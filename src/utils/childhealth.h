@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MEDIASCANNER_SCOPE_CHILDHEALTH_H
+#define MEDIASCANNER_SCOPE_CHILDHEALTH_H
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+class BufferedResultForwarder;
+
+/*
+   Keeps rolling latency and error statistics for the child scopes of an
+   aggregator, shared by all its queries. After a number of consecutive
+   failures (errors, or searches that never finished) a child is skipped
+   for a while; once that cooldown is over, the next query searches it
+   again as a probe, and its outcome decides whether the child is skipped
+   again. Children that are merely slow are not skipped, the page just
+   waits less for them.
+*/
+class ChildHealthTracker
+{
+public:
+    struct Stats
+    {
+        unsigned searches = 0;
+        unsigned failures = 0;
+        unsigned skipped = 0;
+        unsigned consecutive_failures = 0;
+        // exponential moving averages over recent searches
+        double latency_ms = 0;
+        double error_rate = 0;
+        bool skipping = false;
+    };
+
+    ChildHealthTracker(unsigned failure_threshold, std::chrono::milliseconds cooldown);
+
+    // false if the child should be left out of the current query
+    bool should_search(std::string const& child_id);
+    void record(std::string const& child_id, std::chrono::milliseconds latency, bool failed);
+    // the search was cancelled before it told anything about the child
+    void record_cancelled(std::string const& child_id);
+    // how long the page should wait for the child, given the usual deadline
+    std::chrono::milliseconds deadline(std::string const& child_id, std::chrono::milliseconds deadline) const;
+
+    Stats stats(std::string const& child_id) const;
+    void dump(std::ostream& out) const;
+
+private:
+    enum class Circuit
+    {
+        Closed,
+        Open,
+        Probing,
+    };
+
+    struct Health
+    {
+        Stats stats;
+        Circuit circuit = Circuit::Closed;
+        // end of the cooldown when open, start of the probe when probing
+        std::chrono::steady_clock::time_point since;
+    };
+
+    const unsigned failure_threshold_;
+    const std::chrono::milliseconds cooldown_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Health> children_;
+};
+
+/*
+   Records the outcome of the child search fed into forwarder, when it
+   finishes. Missing the deadline only counts as latency; a search still
+   running past its deadline when the aggregator cancels it never
+   finished, and counts as a failure. Other searches cancelled by the
+   aggregator itself are not counted.
+*/
+void watch_child_health(std::shared_ptr<ChildHealthTracker> const& tracker, std::string const& child_id,
+        BufferedResultForwarder& forwarder);
+
+#endif
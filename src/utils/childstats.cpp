@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "childstats.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+typedef std::chrono::steady_clock clock_type;
+
+static long since(clock_type::time_point start, clock_type::time_point when)
+{
+    if (when == clock_type::time_point())
+    {
+        return -1;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(when - start).count();
+}
+
+std::vector<ChildSearchStats> child_search_stats(clock_type::time_point query_start, ChildForwarderList const& children)
+{
+    ChildTimingsList timings;
+    for (auto const& child: children)
+    {
+        timings.emplace_back(child.first, child.second->timings());
+    }
+    return child_search_stats(query_start, timings);
+}
+
+std::vector<ChildSearchStats> child_search_stats(clock_type::time_point query_start, ChildTimingsList const& children)
+{
+    const auto now = clock_type::now();
+    std::vector<ChildSearchStats> result;
+
+    // a forwarder is released once the one before it is, and that one has
+    // finished or missed its deadline; the first one never waits
+    bool released = true;
+    auto release = query_start;
+    for (auto const& child: children)
+    {
+        auto const& timings = child.second;
+        ChildSearchStats stats;
+        stats.child_id = child.first;
+        stats.dispatched_ms = since(query_start, timings.dispatched);
+        stats.first_result_ms = since(query_start, timings.first_result);
+        stats.finished_ms = since(query_start, timings.finished);
+        stats.received = timings.received;
+        stats.filtered = timings.filtered;
+        stats.dropped = timings.dropped;
+        stats.deadline_expired = (timings.deadline_expired != clock_type::time_point());
+
+        if (timings.first_result != clock_type::time_point())
+        {
+            const auto held_until = released ? release : now;
+            if (held_until > timings.first_result)
+            {
+                stats.chain_wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(held_until - timings.first_result).count();
+            }
+        }
+        result.push_back(stats);
+
+        auto done = timings.finished;
+        if (timings.deadline_expired != clock_type::time_point() &&
+            (done == clock_type::time_point() || timings.deadline_expired < done))
+        {
+            done = timings.deadline_expired;
+        }
+        if (done == clock_type::time_point())
+        {
+            released = false;
+        }
+        else
+        {
+            release = std::max(release, done);
+        }
+    }
+    return result;
+}
+
+bool child_stats_logging()
+{
+    static const bool enabled = getenv("MEDIASCANNER_SCOPE_CHILD_STATS") != nullptr;
+    return enabled;
+}
+
+std::ostream& operator<<(std::ostream& out, ChildSearchStats const& stats)
+{
+    out << stats.child_id << ": dispatched=" << stats.dispatched_ms << "ms"
+        << " first_result=" << stats.first_result_ms << "ms"
+        << " finished=" << stats.finished_ms << "ms"
+        << " chain_wait=" << stats.chain_wait_ms << "ms"
+        << " received=" << stats.received
+        << " filtered=" << stats.filtered
+        << " dropped=" << stats.dropped;
+    if (stats.deadline_expired)
+    {
+        out << " (missed deadline)";
+    }
+    return out;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MEDIASCANNER_SCOPE_CHILDSTATS_H
+#define MEDIASCANNER_SCOPE_CHILDSTATS_H
+
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bufferedresultforwarder.h"
+
+/*
+   Where the time went for one child search of an aggregator query.
+   Times are in milliseconds since the query started, or -1 if that
+   didn't happen (yet).
+*/
+struct ChildSearchStats
+{
+    std::string child_id;
+    long dispatched_ms = -1;
+    long first_result_ms = -1;
+    long finished_ms = -1;
+    // results held back while the children shown before were still running
+    long chain_wait_ms = 0;
+    unsigned received = 0;
+    unsigned filtered = 0;
+    unsigned dropped = 0;
+    bool deadline_expired = false;
+};
+
+typedef std::vector<std::pair<std::string, std::shared_ptr<BufferedResultForwarder>>> ChildForwarderList;
+typedef std::vector<std::pair<std::string, BufferedResultForwarder::Timings>> ChildTimingsList;
+
+// children are given in the order they are shown
+std::vector<ChildSearchStats> child_search_stats(std::chrono::steady_clock::time_point query_start,
+        ChildForwarderList const& children);
+std::vector<ChildSearchStats> child_search_stats(std::chrono::steady_clock::time_point query_start,
+        ChildTimingsList const& children);
+
+// set MEDIASCANNER_SCOPE_CHILD_STATS to have aggregator queries log them
+bool child_stats_logging();
+
+std::ostream& operator<<(std::ostream& out, ChildSearchStats const& stats);
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "deadlinetimer.h"
+
+#include <algorithm>
+
+DeadlineTimer& DeadlineTimer::instance()
+{
+    static DeadlineTimer timer;
+    return timer;
+}
+
+DeadlineTimer::DeadlineTimer()
+    : thread_([this]() { run(); })
+{
+}
+
+DeadlineTimer::~DeadlineTimer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    cond_.notify_all();
+    thread_.join();
+}
+
+DeadlineTimer::Id DeadlineTimer::schedule(clock::time_point deadline, std::function<void()> const& callback)
+{
+    Id id;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        id = next_id_++;
+        pending_.emplace(std::make_pair(deadline, id), callback);
+    }
+    // the new deadline may be the earliest one
+    cond_.notify_all();
+    return id;
+}
+
+void DeadlineTimer::cancel(Id id)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto const it = std::find_if(pending_.begin(), pending_.end(),
+            [id](decltype(pending_)::value_type const& entry) { return entry.first.second == id; });
+    if (it != pending_.end())
+    {
+        pending_.erase(it);
+        return;
+    }
+    cond_.wait(lock, [this, id] { return running_ != id; });
+}
+
+void DeadlineTimer::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopped_)
+    {
+        if (pending_.empty())
+        {
+            cond_.wait(lock);
+            continue;
+        }
+        auto const next = pending_.begin();
+        // copied, the entry may be cancelled while waiting
+        const auto due = next->first.first;
+        if (clock::now() < due)
+        {
+            cond_.wait_until(lock, due);
+            continue;
+        }
+
+        auto const callback = next->second;
+        running_ = next->first.second;
+        pending_.erase(next);
+        lock.unlock();
+        callback();
+        lock.lock();
+        running_ = 0;
+        cond_.notify_all();
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MEDIASCANNER_SCOPE_DEADLINETIMER_H
+#define MEDIASCANNER_SCOPE_DEADLINETIMER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+/*
+   Runs callbacks at given points in time, all from a single thread; the
+   forwarders of every child search share it instead of waiting on a
+   thread each. Callbacks should be quick, they hold up the ones due
+   after them.
+*/
+class DeadlineTimer
+{
+public:
+    typedef std::chrono::steady_clock clock;
+    typedef std::uint64_t Id;
+
+    // the timer shared by the whole process, started on first use
+    static DeadlineTimer& instance();
+
+    DeadlineTimer();
+    ~DeadlineTimer();
+
+    Id schedule(clock::time_point deadline, std::function<void()> const& callback);
+    /*
+       Once this returns, the callback of id is not running and won't run.
+       Must not be called from the callback itself.
+    */
+    void cancel(Id id);
+
+private:
+    void run();
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::map<std::pair<clock::time_point, Id>, std::function<void()>> pending_;
+    Id next_id_ = 1;
+    // the callback running right now, outside of the lock
+    Id running_ = 0;
+    bool stopped_ = false;
+    std::thread thread_;
+};
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MEDIASCANNER_SCOPE_FILTEREDRESULTFORWARDER_H
+#define MEDIASCANNER_SCOPE_FILTEREDRESULTFORWARDER_H
+
+#include "bufferedresultforwarder.h"
+
+#include <memory>
+#include <utility>
+
+/*
+   BufferedResultForwarder with the filter known at compile time, so
+   it is called directly (and usually inlined) instead of through a
+   std::function: the base is built without a filter, and push() goes
+   straight from receive() to the filter and forward(). Filter is any
+   callable taking CategorisedResult& and returning whether to forward
+   it.
+*/
+template <typename Filter>
+class FilteredResultForwarder : public BufferedResultForwarder
+{
+public:
+    FilteredResultForwarder(unity::scopes::SearchReplyProxy const& upstream,
+            unity::scopes::utility::BufferedResultForwarder::SPtr const& next_forwarder,
+            Filter filter)
+        : BufferedResultForwarder(upstream, next_forwarder),
+          filter_(std::move(filter))
+    {
+    }
+
+    virtual void push(unity::scopes::CategorisedResult result) override
+    {
+        if (receive())
+        {
+            if (filter_(result))
+            {
+                forward(std::move(result));
+            }
+            else
+            {
+                filtered_out();
+            }
+        }
+    }
+
+protected:
+    virtual bool filter(unity::scopes::CategorisedResult& result) override
+    {
+        return filter_(result);
+    }
+
+private:
+    Filter filter_;
+};
+
+// forwards every result unchanged
+struct PassThroughFilter
+{
+    bool operator()(unity::scopes::CategorisedResult&) const
+    {
+        return true;
+    }
+};
+
+template <typename Filter>
+std::shared_ptr<FilteredResultForwarder<Filter>> make_filtered_forwarder(unity::scopes::SearchReplyProxy const& upstream,
+        unity::scopes::utility::BufferedResultForwarder::SPtr const& next_forwarder,
+        Filter filter)
+{
+    return std::make_shared<FilteredResultForwarder<Filter>>(upstream, next_forwarder, std::move(filter));
+}
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "mediastorepool.h"
+
+MediaStorePool::Handle::Handle(MediaStorePool *pool, std::unique_ptr<mediascanner::MediaStore> store)
+    : pool_(pool),
+      store_(std::move(store))
+{
+}
+
+MediaStorePool::Handle::Handle(Handle&& other)
+    : pool_(other.pool_),
+      store_(std::move(other.store_))
+{
+    other.pool_ = nullptr;
+}
+
+MediaStorePool::Handle& MediaStorePool::Handle::operator=(Handle&& other)
+{
+    if (this != &other)
+    {
+        release();
+        pool_ = other.pool_;
+        store_ = std::move(other.store_);
+        other.pool_ = nullptr;
+    }
+    return *this;
+}
+
+MediaStorePool::Handle::~Handle()
+{
+    release();
+}
+
+void MediaStorePool::Handle::release()
+{
+    if (pool_ && store_)
+    {
+        pool_->checkin(std::move(store_));
+    }
+    pool_ = nullptr;
+}
+
+MediaStorePool::MediaStorePool(unsigned size)
+    : size_(size > 0 ? size : 1)
+{
+}
+
+MediaStorePool::Handle MediaStorePool::acquire()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (idle_.empty() && open_ >= size_)
+    {
+        auto const start = std::chrono::steady_clock::now();
+        stats_.waits++;
+        available_.wait(lock, [this] { return !idle_.empty() || open_ < size_; });
+        stats_.wait_time += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    }
+    return checkout(lock);
+}
+
+MediaStorePool::Handle MediaStorePool::try_acquire()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (idle_.empty() && open_ >= size_)
+    {
+        stats_.misses++;
+        return Handle();
+    }
+    return checkout(lock);
+}
+
+MediaStorePool::Handle MediaStorePool::checkout(std::unique_lock<std::mutex>& lock)
+{
+    stats_.checkouts++;
+    if (!idle_.empty())
+    {
+        std::unique_ptr<mediascanner::MediaStore> store = std::move(idle_.back());
+        idle_.pop_back();
+        return Handle(this, std::move(store));
+    }
+
+    // open a new connection outside of the lock, it can take a while
+    open_++;
+    stats_.opened++;
+    lock.unlock();
+    try
+    {
+        return Handle(this, std::unique_ptr<mediascanner::MediaStore>(new mediascanner::MediaStore(mediascanner::MS_READ_ONLY)));
+    }
+    catch (...)
+    {
+        lock.lock();
+        open_--;
+        available_.notify_one();
+        throw;
+    }
+}
+
+void MediaStorePool::checkin(std::unique_ptr<mediascanner::MediaStore> store)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.push_back(std::move(store));
+    available_.notify_one();
+}
+
+MediaStorePool::Stats MediaStorePool::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+std::ostream& operator<<(std::ostream& out, MediaStorePool::Stats const& stats)
+{
+    return out << stats.checkouts << " checkouts, " << stats.opened << " connections opened, "
+               << stats.waits << " waits (" << stats.wait_time.count() / 1000 << " ms), "
+               << stats.misses << " misses";
+}
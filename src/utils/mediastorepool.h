@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MEDIASCANNER_SCOPE_MEDIASTOREPOOL_H
+#define MEDIASCANNER_SCOPE_MEDIASTOREPOOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include <mediascanner/MediaStore.hh>
+
+/*
+   A small pool of read-only MediaStore connections, so that concurrent
+   queries and previews don't serialize on a single SQLite connection.
+   Connections are opened on demand, up to the size of the pool, and kept
+   around for later queries. The pool must outlive all its handles.
+*/
+class MediaStorePool
+{
+public:
+    struct Stats
+    {
+        unsigned long checkouts = 0;
+        // checkouts that had to wait for another query to return a connection
+        unsigned long waits = 0;
+        // try_acquire() calls that found no free connection
+        unsigned long misses = 0;
+        unsigned long opened = 0;
+        std::chrono::microseconds wait_time {0};
+    };
+
+    // A checked out connection, returned to the pool when destroyed
+    class Handle
+    {
+    public:
+        Handle() = default;
+        Handle(Handle&& other);
+        Handle& operator=(Handle&& other);
+        ~Handle();
+
+        explicit operator bool() const { return store_ != nullptr; }
+        mediascanner::MediaStore const& operator*() const { return *store_; }
+        mediascanner::MediaStore const* operator->() const { return store_.get(); }
+
+    private:
+        friend class MediaStorePool;
+        Handle(MediaStorePool *pool, std::unique_ptr<mediascanner::MediaStore> store);
+        void release();
+
+        MediaStorePool *pool_ = nullptr;
+        std::unique_ptr<mediascanner::MediaStore> store_;
+    };
+
+    explicit MediaStorePool(unsigned size);
+
+    // Blocks while all connections are checked out
+    Handle acquire();
+    // Returns an empty handle instead of waiting
+    Handle try_acquire();
+
+    Stats stats() const;
+
+private:
+    Handle checkout(std::unique_lock<std::mutex>& lock);
+    void checkin(std::unique_ptr<mediascanner::MediaStore> store);
+
+    const unsigned size_;
+    mutable std::mutex mutex_;
+    std::condition_variable available_;
+    std::vector<std::unique_ptr<mediascanner::MediaStore>> idle_;
+    unsigned open_ = 0;
+    Stats stats_;
+};
+
+std::ostream& operator<<(std::ostream& out, MediaStorePool::Stats const& stats);
+
+#endif
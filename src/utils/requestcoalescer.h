@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MEDIASCANNER_SCOPE_REQUESTCOALESCER_H
+#define MEDIASCANNER_SCOPE_REQUESTCOALESCER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+   Shares the result of slow requests (typically network ones) between
+   the queries that need it at the same time. The first caller for a key
+   runs the request on its own thread; later callers for the same key
+   wait for its result. The request is told to give up only once every
+   waiting query has been cancelled.
+*/
+template <typename Value>
+class RequestCoalescer
+{
+public:
+    // returns true when nobody is waiting for the result any more
+    typedef std::function<bool()> Abandoned;
+    typedef std::function<Value(Abandoned const&)> Fetch;
+
+    /*
+       Stores the result of the request for key in result. Returns false,
+       leaving result alone, if cancelled was set before it was ready.
+       Exceptions thrown by fetch are passed on to every waiting caller.
+    */
+    bool run(std::string const& key, std::atomic<bool> const& cancelled, Fetch const& fetch, Value& result)
+    {
+        std::shared_ptr<Flight> flight;
+        bool leader = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = flights_.find(key);
+            if (it == flights_.end())
+            {
+                flight = std::make_shared<Flight>();
+                flight->result = flight->promise.get_future().share();
+                flights_.emplace(key, flight);
+                leader = true;
+            }
+            else
+            {
+                flight = it->second;
+            }
+            flight->waiters.push_back(&cancelled);
+        }
+        Registration registration(*this, flight, cancelled);
+
+        if (leader)
+        {
+            auto abandoned = [this, flight]() -> bool {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return std::all_of(flight->waiters.begin(), flight->waiters.end(),
+                        [](std::atomic<bool> const* waiter) { return waiter->load(); });
+            };
+            try
+            {
+                flight->promise.set_value(fetch(abandoned));
+            }
+            catch (...)
+            {
+                flight->promise.set_exception(std::current_exception());
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            flights_.erase(key);
+        }
+        else
+        {
+            while (flight->result.wait_for(std::chrono::milliseconds(50)) != std::future_status::ready)
+            {
+                if (cancelled)
+                {
+                    return false;
+                }
+            }
+        }
+
+        if (cancelled)
+        {
+            return false;
+        }
+        result = flight->result.get();
+        return true;
+    }
+
+private:
+    struct Flight
+    {
+        std::promise<Value> promise;
+        std::shared_future<Value> result;
+        // cancellation flags of the queries waiting for the result
+        std::vector<std::atomic<bool> const*> waiters;
+    };
+
+    // the flag belongs to the caller, so it is forgotten before run() returns
+    class Registration
+    {
+    public:
+        Registration(RequestCoalescer &owner, std::shared_ptr<Flight> const& flight, std::atomic<bool> const& cancelled)
+            : owner_(owner), flight_(flight), cancelled_(cancelled)
+        {
+        }
+
+        ~Registration()
+        {
+            std::lock_guard<std::mutex> lock(owner_.mutex_);
+            auto &waiters = flight_->waiters;
+            waiters.erase(std::remove(waiters.begin(), waiters.end(), &cancelled_), waiters.end());
+        }
+
+    private:
+        RequestCoalescer &owner_;
+        std::shared_ptr<Flight> flight_;
+        std::atomic<bool> const& cancelled_;
+    };
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<Flight>> flights_;
+};
+
+#endif
@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "sharedsearch.h"
+#include "bufferedresultforwarder.h"
+#include "deadlinetimer.h"
+
+#include <unity/scopes/Location.h>
+#include <unity/scopes/SearchReply.h>
+
+#include <algorithm>
+#include <thread>
+
+using namespace unity::scopes;
+
+// replays and searches of followers go through the middleware, so they
+// don't run on the thread that releases them (a child's reply, the
+// cancelled leader or the deadline timer)
+static void run_detached(std::function<void()> const& task)
+{
+    std::thread(task).detach();
+}
+
+void SharedSearch::record_category(Category::SCPtr const& category)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    categories_.push_back(category);
+}
+
+void SharedSearch::record_child(BufferedResultForwarder& forwarder)
+{
+    std::size_t position;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        position = children_.size();
+        children_.emplace_back();
+        pending_++;
+    }
+    // the forwarder may outlive the leader query
+    auto self = shared_from_this();
+    forwarder.set_result_observer([self, position](CategorisedResult const& result) {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            self->children_[position].push_back(result);
+        });
+    forwarder.add_finished_callback([self](CompletionDetails const& details) {
+            {
+                std::lock_guard<std::mutex> lock(self->mutex_);
+                self->pending_--;
+                if (details.status() == CompletionDetails::Error)
+                {
+                    self->failed_ = true;
+                }
+            }
+            self->check_complete();
+        });
+}
+
+void SharedSearch::dispatched()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        dispatched_ = true;
+    }
+    // followers wait for this
+    cond_.notify_all();
+    check_complete();
+}
+
+void SharedSearch::abandon()
+{
+    std::function<void()> on_done;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (complete_ || abandoned_)
+        {
+            return;
+        }
+        abandoned_ = true;
+        on_done.swap(on_done_);
+    }
+    cond_.notify_all();
+    if (on_done)
+    {
+        on_done();
+    }
+    release_followers();
+}
+
+void SharedSearch::check_complete()
+{
+    std::function<void()> on_done;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!dispatched_ || pending_ > 0 || complete_ || abandoned_)
+        {
+            return;
+        }
+        complete_ = true;
+        on_done.swap(on_done_);
+    }
+    cond_.notify_all();
+    // called without the lock, as it takes the coalescer's
+    if (on_done)
+    {
+        on_done();
+    }
+    release_followers();
+}
+
+bool SharedSearch::follow(SearchReplyProxy const& reply, std::atomic<bool> const& cancelled,
+        std::chrono::milliseconds timeout, std::function<void()> const& search_on_own)
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    unsigned follower;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // the leader only registers its categories and dispatches the
+        // child searches, which is quick
+        while (!dispatched_ && !abandoned_ && !cancelled)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            if (now >= deadline)
+            {
+                break;
+            }
+            // wake up regularly to notice cancellation
+            cond_.wait_for(lock, std::min<std::chrono::steady_clock::duration>(deadline - now, std::chrono::milliseconds(50)));
+        }
+        if (!dispatched_ || abandoned_ || cancelled)
+        {
+            return false;
+        }
+        if (complete_)
+        {
+            lock.unlock();
+            replay(reply);
+            return true;
+        }
+        follower = next_follower_++;
+        followers_[follower] = Follower{reply, search_on_own};
+    }
+
+    // a no-op if the search is done by then
+    std::weak_ptr<SharedSearch> weak_self = shared_from_this();
+    DeadlineTimer::instance().schedule(deadline, [weak_self, follower]() {
+            if (auto self = weak_self.lock())
+            {
+                self->release_follower(follower);
+            }
+        });
+    return true;
+}
+
+void SharedSearch::release_followers()
+{
+    std::map<unsigned, Follower> followers;
+    bool abandoned;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        followers.swap(followers_);
+        abandoned = abandoned_;
+    }
+    if (followers.empty())
+    {
+        return;
+    }
+    auto self = shared_from_this();
+    run_detached([self, followers, abandoned]() {
+            for (auto const& follower: followers)
+            {
+                if (abandoned)
+                {
+                    // the children were cancelled along with the leader
+                    follower.second.search_on_own();
+                }
+                else
+                {
+                    self->replay(follower.second.reply);
+                }
+            }
+        });
+}
+
+void SharedSearch::release_follower(unsigned follower)
+{
+    SearchReplyProxy reply;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = followers_.find(follower);
+        if (it == followers_.end())
+        {
+            return;
+        }
+        reply = it->second.reply;
+        followers_.erase(it);
+    }
+    auto self = shared_from_this();
+    run_detached([self, reply]() { self->replay(reply); });
+}
+
+bool SharedSearch::complete() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return complete_;
+}
+
+bool SharedSearch::failed() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return failed_;
+}
+
+void SharedSearch::replay(SearchReplyProxy const& reply) const
+{
+    std::vector<Category::SCPtr> categories;
+    std::vector<std::vector<CategorisedResult>> children;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        categories = categories_;
+        children = children_;
+    }
+
+    std::unordered_map<std::string, Category::SCPtr> registered;
+    for (auto const& category: categories)
+    {
+        auto const query = category->query();
+        registered[category->id()] = query ?
+            reply->register_category(category->id(), category->title(), category->icon(), *query, category->renderer_template()) :
+            reply->register_category(category->id(), category->title(), category->icon(), category->renderer_template());
+    }
+
+    for (auto results = children.rbegin(); results != children.rend(); ++results)
+    {
+        for (auto& result: *results)
+        {
+            // results the leader forwarded with the child's category are pushed unchanged
+            auto it = registered.find(result.category()->id());
+            if (it != registered.end())
+            {
+                result.set_category(it->second);
+            }
+            if (!reply->push(result))
+            {
+                return; // the follower was cancelled
+            }
+        }
+    }
+}
+
+SharedSearchGuard::SharedSearchGuard(std::shared_ptr<SharedSearch> const& search)
+    : search_(search)
+{
+}
+
+SharedSearchGuard::~SharedSearchGuard()
+{
+    if (search_)
+    {
+        search_->abandon();
+    }
+}
+
+void SharedSearchGuard::dispatched()
+{
+    if (search_)
+    {
+        search_->dispatched();
+        search_.reset();
+    }
+}
+
+SearchCoalescer::SearchCoalescer(std::chrono::seconds ttl)
+    : ttl_(ttl)
+{
+}
+
+std::shared_ptr<SharedSearch> SearchCoalescer::join(std::string const& key, bool cacheable, bool& leader)
+{
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    for (auto it = cache_.begin(); it != cache_.end(); )
+    {
+        if (it->second.expires <= now)
+        {
+            it = cache_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    if (cacheable)
+    {
+        auto it = cache_.find(key);
+        if (it != cache_.end())
+        {
+            leader = false;
+            return it->second.search;
+        }
+    }
+
+    auto it = in_flight_.find(key);
+    if (it != in_flight_.end())
+    {
+        if (auto search = it->second.lock())
+        {
+            leader = false;
+            return search;
+        }
+    }
+
+    auto search = std::make_shared<SharedSearch>();
+    std::weak_ptr<SearchCoalescer> weak_self = shared_from_this();
+    std::weak_ptr<SharedSearch> weak_search = search;
+    search->on_done_ = [weak_self, weak_search, key, cacheable]() {
+        auto self = weak_self.lock();
+        auto search = weak_search.lock();
+        if (self && search)
+        {
+            self->done(key, search, cacheable);
+        }
+    };
+    in_flight_[key] = search;
+    leader = true;
+    return search;
+}
+
+void SearchCoalescer::done(std::string const& key, std::shared_ptr<SharedSearch> const& search, bool cacheable)
+{
+    // a page missing the results of a failed child is not kept around
+    const bool complete = search->complete() && !search->failed();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = in_flight_.find(key);
+    if (it != in_flight_.end() && it->second.lock() == search)
+    {
+        in_flight_.erase(it);
+    }
+    if (cacheable && complete)
+    {
+        cache_[key] = Cached{search, std::chrono::steady_clock::now() + ttl_};
+    }
+}
+
+std::string shared_search_key(CannedQuery const& query, SearchMetadata const& metadata, ChildScopeList const& children)
+{
+    // everything in the metadata the children may answer differently to
+    std::string key = query.query_string() + '\n' + query.department_id() + '\n'
+        + metadata.locale() + '\n' + metadata.form_factor() + '\n'
+        + std::to_string(metadata.cardinality()) + '\n'
+        + std::to_string(static_cast<int>(metadata.internet_connectivity()));
+    if (metadata.has_location())
+    {
+        auto const location = metadata.location();
+        key += '\n' + std::to_string(location.latitude()) + ',' + std::to_string(location.longitude());
+    }
+    for (auto const& child: children)
+    {
+        if (child.enabled)
+        {
+            key += '\n' + child.id;
+        }
+    }
+    return key;
+}
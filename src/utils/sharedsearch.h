@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MEDIASCANNER_SCOPE_SHAREDSEARCH_H
+#define MEDIASCANNER_SCOPE_SHAREDSEARCH_H
+
+#include <unity/scopes/CannedQuery.h>
+#include <unity/scopes/CategorisedResult.h>
+#include <unity/scopes/Category.h>
+#include <unity/scopes/ChildScope.h>
+#include <unity/scopes/ReplyProxyFwd.h>
+#include <unity/scopes/SearchMetadata.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class BufferedResultForwarder;
+
+/*
+   The outcome of an aggregator search, shared with identical queries.
+   The query running the search (the leader) records the categories it
+   registers and the results each child forwarder lets through; the
+   other queries (followers) get the recording replayed on their own
+   reply once it completes. A follower only waits for the leader to
+   dispatch its search, not for the children, so that it does not hold a
+   middleware thread; if the leader is cancelled after that, the
+   followers search on their own.
+*/
+class SharedSearch : public std::enable_shared_from_this<SharedSearch>
+{
+public:
+    // leader side
+    void record_category(unity::scopes::Category::SCPtr const& category);
+    // records the results of a child; as in the forwarder chain, the
+    // results of a child recorded later are shown before the earlier ones
+    void record_child(BufferedResultForwarder& forwarder);
+    // every child has been recorded: the search completes once they have finished
+    void dispatched();
+    // the leader was cancelled, so the recording is incomplete
+    void abandon();
+
+    /*
+       Follower side: waits until the leader has dispatched its search and
+       returns true. The recording is then replayed on reply when the
+       search completes or timeout passes, whichever comes first; if the
+       leader gives up instead, search_on_own is called. Both happen on a
+       thread of their own, as the follower has returned by then. Returns
+       false if cancelled was set, or if the leader gave up or timed out
+       before dispatching.
+    */
+    bool follow(unity::scopes::SearchReplyProxy const& reply, std::atomic<bool> const& cancelled,
+            std::chrono::milliseconds timeout, std::function<void()> const& search_on_own);
+    // pushes what has been recorded so far
+    void replay(unity::scopes::SearchReplyProxy const& reply) const;
+    bool complete() const;
+    // a child search failed, so the recording is not worth caching
+    bool failed() const;
+
+private:
+    friend class SearchCoalescer;
+
+    struct Follower
+    {
+        unity::scopes::SearchReplyProxy reply;
+        std::function<void()> search_on_own;
+    };
+
+    void check_complete();
+    // replays the recording to the followers still waiting for it, or
+    // lets them search on their own if it was abandoned
+    void release_followers();
+    // timed out
+    void release_follower(unsigned follower);
+
+    mutable std::mutex mutex_;
+    mutable std::condition_variable cond_;
+    std::vector<unity::scopes::Category::SCPtr> categories_;
+    std::vector<std::vector<unity::scopes::CategorisedResult>> children_;
+    unsigned pending_ = 0;
+    bool dispatched_ = false;
+    bool complete_ = false;
+    bool abandoned_ = false;
+    bool failed_ = false;
+    std::map<unsigned, Follower> followers_;
+    unsigned next_follower_ = 0;
+    // set by the coalescer, called once complete or abandoned
+    std::function<void()> on_done_;
+};
+
+/*
+   Held by a leader while it sets up its search: unless dispatched() is
+   called, the recording is abandoned when the guard goes, so that a
+   leader returning early or throwing does not keep followers waiting.
+*/
+class SharedSearchGuard
+{
+public:
+    // search may be null
+    explicit SharedSearchGuard(std::shared_ptr<SharedSearch> const& search);
+    ~SharedSearchGuard();
+
+    SharedSearchGuard(SharedSearchGuard const&) = delete;
+    SharedSearchGuard& operator=(SharedSearchGuard const&) = delete;
+
+    // every child has been recorded
+    void dispatched();
+
+private:
+    std::shared_ptr<SharedSearch> search_;
+};
+
+/*
+   Hands out SharedSearch objects for identical queries of an aggregator
+   that overlap, and keeps the complete ones around for a short while
+   when they may be cached (i.e. surfacing) and no child search failed.
+*/
+class SearchCoalescer : public std::enable_shared_from_this<SearchCoalescer>
+{
+public:
+    explicit SearchCoalescer(std::chrono::seconds ttl);
+
+    // sets leader if the caller has to run the search itself
+    std::shared_ptr<SharedSearch> join(std::string const& key, bool cacheable, bool& leader);
+
+private:
+    void done(std::string const& key, std::shared_ptr<SharedSearch> const& search, bool cacheable);
+
+    struct Cached
+    {
+        std::shared_ptr<SharedSearch> search;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    const std::chrono::seconds ttl_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::weak_ptr<SharedSearch>> in_flight_;
+    std::unordered_map<std::string, Cached> cache_;
+};
+
+// identifies the queries that can share a search
+std::string shared_search_key(unity::scopes::CannedQuery const& query, unity::scopes::SearchMetadata const& metadata,
+        unity::scopes::ChildScopeList const& children);
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "storegeneration.h"
+#include <cstdlib>
+#include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// size of the wal-index header, see "WalIndexHdr" in sqlite's wal.c; it
+// holds the change counter and the last frame of the write-ahead log
+static const std::size_t WAL_INDEX_HEADER_SIZE = 48;
+
+// mirrors the location used by mediascanner::MediaStore
+static std::string mediastore_path()
+{
+    const char *cachedir = getenv("MEDIASCANNER_CACHEDIR");
+    if (cachedir)
+    {
+        return std::string(cachedir) + "/mediastore.db";
+    }
+    const char *xdg_cache = getenv("XDG_CACHE_HOME");
+    if (xdg_cache && xdg_cache[0] != '\0')
+    {
+        return std::string(xdg_cache) + "/mediascanner-2.0/mediastore.db";
+    }
+    const char *home = getenv("HOME");
+    return std::string(home ? home : "") + "/.cache/mediascanner-2.0/mediastore.db";
+}
+
+// FNV-1a, so that different fields can't cancel each other out
+static void mix(std::uint64_t &hash, void const *data, std::size_t size)
+{
+    auto const bytes = static_cast<unsigned char const*>(data);
+    for (std::size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+}
+
+static bool mix_file_stamp(std::uint64_t &hash, std::string const& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        return false;
+    }
+    const std::uint64_t fields[] = {
+        static_cast<std::uint64_t>(st.st_ino),
+        static_cast<std::uint64_t>(st.st_size),
+        static_cast<std::uint64_t>(st.st_mtim.tv_sec),
+        static_cast<std::uint64_t>(st.st_mtim.tv_nsec),
+    };
+    mix(hash, fields, sizeof(fields));
+    return true;
+}
+
+static void mix_wal_index(std::uint64_t &hash, std::string const& path)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+    unsigned char header[WAL_INDEX_HEADER_SIZE];
+    if (pread(fd, header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)))
+    {
+        mix(hash, header, sizeof(header));
+    }
+    close(fd);
+}
+
+std::uint64_t mediastore_generation()
+{
+    const std::string db = mediastore_path();
+    std::uint64_t hash = 14695981039346656037ULL;
+    if (!mix_file_stamp(hash, db))
+    {
+        return 0;
+    }
+    // sqlite in WAL mode only touches the main file on checkpoint
+    mix_file_stamp(hash, db + "-wal");
+    mix_wal_index(hash, db + "-shm");
+    // zero is reserved for an unknown state
+    return hash != 0 ? hash : 1;
+}
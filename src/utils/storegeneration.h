@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MEDIASCANNER_SCOPE_STOREGENERATION_H
+#define MEDIASCANNER_SCOPE_STOREGENERATION_H
+
+#include <cstdint>
+
+/*
+   Returns a stamp of the current state of the mediascanner database.
+   The stamp changes whenever the database (or its write-ahead log) is
+   written to; it is computed with a couple of stat() calls and one small
+   read, so it is cheap enough to check on every query.
+
+   Zero means the state is unknown (the database could not be found):
+   nothing derived from the store may be cached or saved under it.
+
+   The file times alone have the granularity of the kernel clock tick,
+   and a write-ahead log that is reset and written again can keep its
+   size, so the stamp also covers the header of the shared wal-index,
+   which sqlite updates on every transaction. Without a wal-index (no
+   connection has the database open) a write within the same clock tick
+   as the previous stamp may go unnoticed until the next write; callers
+   then serve slightly stale data, they never serve another database.
+*/
+std::uint64_t mediastore_generation();
+
+#endif
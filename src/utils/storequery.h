@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MEDIASCANNER_SCOPE_STOREQUERY_H
+#define MEDIASCANNER_SCOPE_STOREQUERY_H
+
+#include <atomic>
+#include <mediascanner/Filter.hh>
+
+/*
+   Runs a store query for at most limit rows and hands every row to
+   handle_row. Stops as soon as the query is cancelled or handle_row
+   returns false, in which case false is returned.
+
+   The rows are fetched with a single store query. Paging with the filter
+   offset would re-run the whole query (full text ranking included) for
+   every page, and rows would shift between pages whenever the scanner
+   writes in between. The limits used by the scopes are small, so the
+   cancellation checks between rows are what keeps a superseded query
+   from doing more work.
+*/
+template <typename Fetch, typename Handle>
+bool for_each_row(std::atomic<bool> const& cancelled, mediascanner::Filter filter, int limit,
+        Fetch fetch, Handle handle_row)
+{
+    if (cancelled || limit <= 0)
+    {
+        return false;
+    }
+    filter.setOffset(0);
+    filter.setLimit(limit);
+    auto const rows = fetch(filter);
+    for (auto const& row: rows)
+    {
+        if (cancelled || !handle_row(row))
+        {
+            return false;
+        }
+    }
+    return !cancelled;
+}
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "trace.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace unity::scopes;
+
+static const char TRACE_ID_HINT[] = "mediascanner-trace-id";
+static const char DISPATCH_TIME_HINT[] = "mediascanner-dispatch-us";
+
+static std::int64_t to_us(QueryTrace::clock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+}
+
+static std::string json_escape(std::string const& text)
+{
+    std::string escaped;
+    for (char c: text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+        }
+        if (static_cast<unsigned char>(c) >= 0x20)
+        {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// the trace file, shared by every query of the process; -1 if disabled
+static int trace_fd()
+{
+    static int fd = -1;
+    static std::once_flag once;
+    std::call_once(once, []() {
+            const char *path = getenv("MEDIASCANNER_SCOPE_TRACE_FILE");
+            if (!path || !*path)
+            {
+                return;
+            }
+            fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+            if (fd < 0)
+            {
+                std::cerr << "Cannot open trace file " << path << ": " << strerror(errno) << std::endl;
+                return;
+            }
+            // Chrome's array format doesn't need the closing bracket
+            struct stat st;
+            if (::fstat(fd, &st) == 0 && st.st_size == 0)
+            {
+                if (::write(fd, "[\n", 2) != 2)
+                {
+                    std::cerr << "Cannot write trace file " << path << ": " << strerror(errno) << std::endl;
+                }
+            }
+        });
+    return fd;
+}
+
+static std::string new_trace_id()
+{
+    static std::atomic<unsigned> counter(0);
+    char id[64];
+    snprintf(id, sizeof(id), "%d-%llx-%u", static_cast<int>(getpid()),
+             static_cast<unsigned long long>(to_us(QueryTrace::clock::now())), counter++);
+    return id;
+}
+
+QueryTrace::QueryTrace(std::string const& scope_id, SearchMetadata const& metadata)
+    : scope_id_(scope_id),
+      created_(clock::now()),
+      finished_(false)
+{
+    if (!enabled())
+    {
+        return;
+    }
+    auto const hints = metadata.hints();
+    auto const id = hints.find(TRACE_ID_HINT);
+    auto const dispatch_time = hints.find(DISPATCH_TIME_HINT);
+    try
+    {
+        if (id != hints.end())
+        {
+            trace_id_ = id->second.get_string();
+        }
+        if (dispatch_time != hints.end())
+        {
+            // time between the aggregator dispatching the search and this query existing
+            const clock::time_point dispatched(std::chrono::microseconds(dispatch_time->second.get_int64_t()));
+            span("queued", dispatched, created_);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Ignoring invalid trace hints: " << e.what() << std::endl;
+    }
+    if (trace_id_.empty())
+    {
+        trace_id_ = new_trace_id();
+    }
+}
+
+void QueryTrace::finish()
+{
+    if (enabled() && !finished_.exchange(true))
+    {
+        span("query", created_);
+    }
+}
+
+bool QueryTrace::enabled() const
+{
+    return trace_fd() >= 0;
+}
+
+void QueryTrace::span(std::string const& name, clock::time_point start) const
+{
+    span(name, start, clock::now());
+}
+
+void QueryTrace::span(std::string const& name, clock::time_point start, clock::time_point end, unsigned lane) const
+{
+    const int fd = trace_fd();
+    if (fd < 0)
+    {
+        return;
+    }
+    const auto tid = std::hash<std::thread::id>()(std::this_thread::get_id()) % 100000 + lane * 100000;
+    std::ostringstream event;
+    event << "{\"name\":\"" << json_escape(name) << "\",\"cat\":\"" << json_escape(scope_id_)
+          << "\",\"ph\":\"X\",\"ts\":" << to_us(start) << ",\"dur\":" << to_us(end) - to_us(start)
+          << ",\"pid\":" << getpid() << ",\"tid\":" << tid
+          << ",\"args\":{\"trace_id\":\"" << json_escape(trace_id_) << "\"}},\n";
+    const std::string line = event.str();
+    // a single append keeps the lines of concurrent writers apart
+    if (::write(fd, line.data(), line.size()) < 0)
+    {
+        std::cerr << "Cannot write trace event: " << strerror(errno) << std::endl;
+    }
+}
+
+void QueryTrace::propagate(SearchMetadata& metadata) const
+{
+    if (!enabled())
+    {
+        return;
+    }
+    metadata.set_hint(TRACE_ID_HINT, Variant(trace_id_));
+    metadata.set_hint(DISPATCH_TIME_HINT, Variant(static_cast<std::int64_t>(to_us(clock::now()))));
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MEDIASCANNER_SCOPE_TRACE_H
+#define MEDIASCANNER_SCOPE_TRACE_H
+
+#include <unity/scopes/SearchMetadata.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+/*
+   Query tracing in Chrome's trace event format. It is enabled by setting
+   MEDIASCANNER_SCOPE_TRACE_FILE to the file the events are appended to;
+   the aggregators and the local scopes can share it, as the timestamps
+   come from the monotonic clock, which is the same for every process.
+
+   An aggregator gives each child search a trace id and the time it was
+   dispatched as hints, so the child logs its phases under the same id
+   and the time the search spent getting to it shows up.
+*/
+class QueryTrace
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    // picks up the trace id and dispatch time given by an aggregator, if any
+    QueryTrace(std::string const& scope_id, unity::scopes::SearchMetadata const& metadata);
+
+    QueryTrace(QueryTrace const&) = delete;
+    QueryTrace& operator=(QueryTrace const&) = delete;
+
+    bool enabled() const;
+    // logs a phase of the query; lane separates phases that overlap
+    void span(std::string const& name, clock::time_point start, clock::time_point end, unsigned lane = 0) const;
+    void span(std::string const& name, clock::time_point start) const;
+    // adds the trace hints to the metadata of a child search dispatched now
+    void propagate(unity::scopes::SearchMetadata& metadata) const;
+    // logs the whole query, from creation; call it once the query has
+    // completed, only the first call counts. A query never finished,
+    // e.g. because it threw, is not logged.
+    void finish();
+
+private:
+    const std::string scope_id_;
+    std::string trace_id_;
+    const clock::time_point created_;
+    std::atomic<bool> finished_;
+};
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ttlcache.h"
+#include "cachefile.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <sys/stat.h>
+
+static const std::uint32_t TTL_ENTRY_MAGIC = 0x4d535454; // "MSTT"
+
+// FNV-1a, stable across builds unlike std::hash
+static std::uint64_t key_hash(std::string const& key)
+{
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c: key)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+TtlFileCache::TtlFileCache(std::string const& directory, std::chrono::seconds ttl)
+    : directory_(directory),
+      ttl_(ttl)
+{
+}
+
+std::string TtlFileCache::entry_path(std::string const& key) const
+{
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key_hash(key)));
+    return directory_ + "/" + name;
+}
+
+bool TtlFileCache::get(std::string const& key, std::string& value) const
+{
+    const std::string path = entry_path(key);
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        return false;
+    }
+    if (std::difftime(std::time(nullptr), st.st_mtime) > ttl_.count())
+    {
+        return false;
+    }
+
+    try
+    {
+        CacheFileReader in;
+        // the entry key guards against hash collisions
+        if (!in.open(path) || in.get_u32() != TTL_ENTRY_MAGIC || in.get_string() != key)
+        {
+            return false;
+        }
+        value = in.get_string();
+        return true;
+    }
+    catch (const std::runtime_error &)
+    {
+        return false;
+    }
+}
+
+void TtlFileCache::put(std::string const& key, std::string const& value) const
+{
+    if (mkdir(directory_.c_str(), 0700) != 0 && errno != EEXIST)
+    {
+        throw std::runtime_error("Cannot create " + directory_ + ": " + strerror(errno));
+    }
+
+    CacheFileWriter out;
+    out.put_u32(TTL_ENTRY_MAGIC);
+    out.put_string(key);
+    out.put_string(value);
+    out.save(entry_path(key));
+}
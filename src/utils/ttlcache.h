@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2016 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MEDIASCANNER_SCOPE_TTLCACHE_H
+#define MEDIASCANNER_SCOPE_TTLCACHE_H
+
+#include <chrono>
+#include <string>
+
+/*
+   Persistent string cache with a time to live, one small file per entry
+   in the given directory. Entries older than the ttl are ignored, and
+   replaced by the next put() for the same key.
+*/
+class TtlFileCache
+{
+public:
+    TtlFileCache(std::string const& directory, std::chrono::seconds ttl);
+
+    // returns false if there is no valid entry for key
+    bool get(std::string const& key, std::string& value) const;
+    // throws std::runtime_error if the entry can't be written
+    void put(std::string const& key, std::string const& value) const;
+
+private:
+    std::string entry_path(std::string const& key) const;
+
+    const std::string directory_;
+    const std::chrono::seconds ttl_;
+};
+
+#endif
@@ -18,7 +18,9 @@
  */
 
 #include "utils.h"
-#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_set>
 #include <unity/scopes/ScopeMetadata.h>
 
 unity::scopes::ChildScopeList find_child_scopes_by_keywords(
@@ -27,14 +29,20 @@ unity::scopes::ChildScopeList find_child_scopes_by_keywords(
         std::vector<std::string> const& predefined_scopes,
         std::string const& keyword)
 {
-    auto scopes = registry->list_if([keyword, aggregator_scope_id, predefined_scopes](unity::scopes::ScopeMetadata const& item)
+    const std::unordered_set<std::string> predefined_ids(predefined_scopes.begin(), predefined_scopes.end());
+    auto scopes = registry->list_if([&keyword, &aggregator_scope_id, &predefined_ids](unity::scopes::ScopeMetadata const& item)
     {
-        if (item.scope_id() == aggregator_scope_id)
+        auto const scope_id = item.scope_id();
+        if (scope_id == aggregator_scope_id)
         {
             return false;
         }
-        auto keywords = item.keywords();
-        return keywords.find(keyword) != keywords.end() || std::find(predefined_scopes.begin(), predefined_scopes.end(), item.scope_id()) != predefined_scopes.end();
+        if (predefined_ids.find(scope_id) != predefined_ids.end())
+        {
+            return true;
+        }
+        auto const keywords = item.keywords();
+        return keywords.find(keyword) != keywords.end();
     });
 
     unity::scopes::ChildScopeList list;
@@ -57,3 +65,98 @@ unity::scopes::ChildScopeList find_child_scopes_by_keywords(
     }
     return list;
 }
+
+struct ChildScopeDiscovery::Cache
+{
+    void invalidate()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        valid = false;
+        generation++;
+    }
+
+    std::mutex mutex;
+    unity::scopes::ChildScopeList list;
+    bool valid = false;
+    unsigned generation = 0;
+};
+
+ChildScopeDiscovery::ChildScopeDiscovery(std::string const& aggregator_scope_id,
+        std::vector<std::string> const& predefined_scopes,
+        std::string const& keyword)
+    : aggregator_scope_id_(aggregator_scope_id),
+      predefined_scopes_(predefined_scopes),
+      keyword_(keyword),
+      cache_(std::make_shared<Cache>())
+{
+}
+
+ChildScopeDiscovery::~ChildScopeDiscovery()
+{
+    std::unique_ptr<core::ScopedConnection> changes;
+    {
+        std::lock_guard<std::mutex> lock(cache_->mutex);
+        changes.swap(registry_changes_);
+    }
+    // disconnected without the lock, which a notification running now may be waiting for
+    changes.reset();
+}
+
+unity::scopes::ChildScopeList ChildScopeDiscovery::find(unity::scopes::RegistryProxy const& registry) const
+{
+    unsigned generation;
+    {
+        std::lock_guard<std::mutex> lock(cache_->mutex);
+        if (!registry_changes_)
+        {
+            try
+            {
+                std::weak_ptr<Cache> const cache = cache_;
+                registry_changes_.reset(new core::ScopedConnection(
+                    registry->set_list_update_callback([cache]() {
+                        auto const current = cache.lock();
+                        if (current)
+                        {
+                            current->invalidate();
+                        }
+                    })));
+            }
+            catch (const std::exception &e)
+            {
+                // without notifications, the list can't be cached
+                std::cerr << "Cannot watch the scope registry: " << e.what() << std::endl;
+            }
+        }
+        if (cache_->valid)
+        {
+            return cache_->list;
+        }
+        generation = cache_->generation;
+    }
+
+    // the registry is asked without holding the lock
+    auto list = find_child_scopes_by_keywords(aggregator_scope_id_, registry, predefined_scopes_, keyword_);
+
+    std::lock_guard<std::mutex> lock(cache_->mutex);
+    if (registry_changes_ && generation == cache_->generation)
+    {
+        cache_->list = list;
+        cache_->valid = true;
+    }
+    return list;
+}
+
+void ChildScopeDiscovery::invalidate() const
+{
+    cache_->invalidate();
+}
+
+int query_result_limit(unity::scopes::SearchMetadata const& metadata, int max_results)
+{
+    const int cardinality = metadata.cardinality();
+    if (cardinality > 0 && cardinality < max_results)
+    {
+        return cardinality;
+    }
+    return max_results;
+}
@@ -22,6 +22,9 @@
 
 #include <unity/scopes/ChildScope.h>
 #include <unity/scopes/Registry.h>
+#include <unity/scopes/SearchMetadata.h>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
 #include <set>
@@ -32,4 +35,43 @@ unity::scopes::ChildScopeList find_child_scopes_by_keywords(
         std::vector<std::string> const& predefined_scopes,
         std::string const& keyword);
 
+/*
+   Caches the result of find_child_scopes_by_keywords() for an aggregator,
+   until the registry reports that the list of scopes changed.
+*/
+class ChildScopeDiscovery
+{
+public:
+    ChildScopeDiscovery(std::string const& aggregator_scope_id,
+            std::vector<std::string> const& predefined_scopes,
+            std::string const& keyword);
+    // stops the registry notifications
+    ~ChildScopeDiscovery();
+
+    ChildScopeDiscovery(ChildScopeDiscovery const&) = delete;
+    ChildScopeDiscovery& operator=(ChildScopeDiscovery const&) = delete;
+
+    unity::scopes::ChildScopeList find(unity::scopes::RegistryProxy const& registry) const;
+    void invalidate() const;
+
+private:
+    const std::string aggregator_scope_id_;
+    const std::vector<std::string> predefined_scopes_;
+    const std::string keyword_;
+
+    struct Cache;
+    // the registry notifies from its own threads, so a notification may
+    // still be running once this is destroyed; it only holds on to the cache
+    const std::shared_ptr<Cache> cache_;
+    // guarded by the mutex of the cache
+    mutable std::unique_ptr<core::ScopedConnection> registry_changes_;
+};
+
+/*
+   Returns the number of results worth producing for a query: the
+   cardinality requested in the search metadata, if any, capped at
+   max_results.
+*/
+int query_result_limit(unity::scopes::SearchMetadata const& metadata, int max_results);
+
 #endif
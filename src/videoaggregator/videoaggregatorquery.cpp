@@ -20,6 +20,8 @@
 
 #include <config.h>
 
+#include <chrono>
+#include <iostream>
 #include <cstdio>
 
 #include <unity/scopes/Annotation.h>
@@ -27,6 +29,8 @@
 #include <unity/scopes/CategoryRenderer.h>
 #include <unity/scopes/Category.h>
 #include <unity/scopes/CannedQuery.h>
+#include <unity/scopes/QueryCtrl.h>
+#include <unity/scopes/SearchMetadata.h>
 #include <unity/scopes/SearchReply.h>
 #include <algorithm>
 
@@ -34,9 +38,17 @@
 #include "videoaggregatorquery.h"
 #include "videoaggregatorscope.h"
 #include "../utils/bufferedresultforwarder.h"
+#include "../utils/childcategoryforwarder.h"
+#include "../utils/childhealth.h"
+#include "../utils/filteredresultforwarder.h"
+#include "../utils/sharedsearch.h"
 
 using namespace unity::scopes;
 
+// how long the page waits for a remote child scope before the categories
+// after it are shown; its late results are still appended
+static const std::chrono::milliseconds CHILD_SCOPE_DEADLINE(2500);
+
 // FIXME: once child scopes are updated to handle is_aggregated flag, they should provide
 // own renderer for aggregator and these definition should be removed
 static char SURFACING_CATEGORY_DEFINITION[] = R"(
@@ -76,36 +88,52 @@ static char SEARCH_CATEGORY_DEFINITION[] = R"(
 }
 )";
 
-VideoAggregatorQuery::VideoAggregatorQuery(CannedQuery const& query, SearchMetadata const& hints, ChildScopeList const& scopes) :
+VideoAggregatorQuery::VideoAggregatorQuery(CannedQuery const& query, SearchMetadata const& hints, ChildScopeList const& scopes,
+        std::shared_ptr<ChildHealthTracker> const& child_health,
+        std::shared_ptr<SearchCoalescer> const& coalescer) :
     SearchQueryBase(query, hints),
-    child_scopes(scopes) {
+    child_scopes(scopes),
+    child_health(child_health),
+    child_searches(query, hints, coalescer) {
         std::reverse(child_scopes.begin(), child_scopes.end());
 }
 
-VideoAggregatorQuery::~VideoAggregatorQuery() {
+std::vector<ChildSearchStats> VideoAggregatorQuery::child_stats() {
+    return child_searches.stats();
 }
 
 void VideoAggregatorQuery::cancelled() {
+    child_searches.cancel();
 }
 
 void VideoAggregatorQuery::run(unity::scopes::SearchReplyProxy const& parent_reply) {
+    child_searches.start();
+    search(parent_reply);
+}
+
+void VideoAggregatorQuery::search(unity::scopes::SearchReplyProxy const& parent_reply) {
     const std::string query_string = query().query_string();
     const bool surfacing = query_string.empty();
     const std::string department_id = "aggregated:videoaggregator"; //FIXME: remove when child scopes handle is_aggregated
     const FilterState filter_state;
 
-    unity::scopes::utility::BufferedResultForwarder::SPtr next_forwarder;
+    // surfacing results are cached for a while
+    std::shared_ptr<SharedSearch> recording;
+    // the follower's reply keeps this query alive until it is answered
+    if (child_searches.follow_shared_search(parent_reply, child_scopes, surfacing, recording,
+                [this, parent_reply]() { search(parent_reply); }))
+    {
+        child_searches.dispatched();
+        return;
+    }
+    SharedSearchGuard recording_guard(recording);
 
-    //
-    // maps scope id to category id of first received result from that scope.
-    // this is used to ignore results from different categories (i.e. child scope is
-    // misbehaving when aggregated).
-    std::map<std::string, std::string> child_id_to_category_id;
-    std::mutex child_id_map_mutex;
+    std::shared_ptr<BufferedResultForwarder> next_forwarder;
 
     // Create forwarders for the other sub-scopes
     for (auto const& child: child_scopes) {
-        if (child.enabled)
+        // children that keep failing are left out until it's time to probe them again
+        if (child.enabled && (child.id == VideoAggregatorScope::local_videos_scope || !child_health || child_health->should_search(child.id)))
         {
             bool const is_predefined_scope = (std::find(VideoAggregatorScope::predefined_scopes.begin(),
                         VideoAggregatorScope::predefined_scopes.end(),
@@ -117,47 +145,52 @@ void VideoAggregatorQuery::run(unity::scopes::SearchReplyProxy const& parent_rep
             if (child_id == VideoAggregatorScope::local_videos_scope)
             {
                 // preserve category of local videos
-                next_forwarder = std::make_shared<BufferedResultForwarder>(parent_reply, next_forwarder);
+                next_forwarder = make_filtered_forwarder(parent_reply, next_forwarder, PassThroughFilter());
             }
             else
             {
-                next_forwarder = std::make_shared<BufferedResultForwarder>(parent_reply, next_forwarder, [this, parent_reply, is_predefined_scope, surfacing,
-                        child_id, child_name, &child_id_to_category_id, &child_id_map_mutex](CategorisedResult& res) -> bool {
-                        // register a single category for aggregated results of this child scope and update incoming results with this category;
+                next_forwarder = std::make_shared<ChildCategoryForwarder>(parent_reply, next_forwarder, [query_string, parent_reply, is_predefined_scope, surfacing,
+                        child_id, child_name, recording](CategorisedResult const& first) -> Category::SCPtr {
+                        // register a single category for aggregated results of this child scope;
                         // the new category has custom id and title, but reuses the renderer of first incoming result (except for predefined scopes, which
                         // for now use renderers hardcoded in the aggregator
-                        Category::SCPtr category = parent_reply->lookup_category(child_id);
-                        if (!category) {
-                            CannedQuery category_query(child_id, query().query_string(), "");
-                            auto const renderer = is_predefined_scope ? CategoryRenderer(surfacing ? SURFACING_CATEGORY_DEFINITION : SEARCH_CATEGORY_DEFINITION)
-                                                        : res.category()->renderer_template();
-                            char title[500];
-                            if (surfacing) {
-                                /* TRANSLATORS: Featured on YouTube, Featured on Grooveshark, etc. */
-                                snprintf(title, sizeof(title), _("Featured on %s"), child_name.c_str());
-                            } else {
-                                snprintf(title, sizeof(title), _("Results from %s"), child_name.c_str());
-                            }
-                            category = parent_reply->register_category(child_id, title, "" /* icon */, category_query, renderer);
-
-                            // remember the first encountered category for this child
-                            {
-                                std::lock_guard<std::mutex> lock(child_id_map_mutex);
-                                child_id_to_category_id[child_id] = res.category()->id();
-                            }
+                        CannedQuery category_query(child_id, query_string, "");
+                        auto const renderer = is_predefined_scope ? CategoryRenderer(surfacing ? SURFACING_CATEGORY_DEFINITION : SEARCH_CATEGORY_DEFINITION)
+                                                    : first.category()->renderer_template();
+                        char title[500];
+                        if (surfacing) {
+                            /* TRANSLATORS: Featured on YouTube, Featured on Grooveshark, etc. */
+                            snprintf(title, sizeof(title), _("Featured on %s"), child_name.c_str());
+                        } else {
+                            snprintf(title, sizeof(title), _("Results from %s"), child_name.c_str());
                         }
-
+                        auto category = parent_reply->register_category(child_id, title, "" /* icon */, category_query, renderer);
+                        if (recording)
                         {
-                            std::lock_guard<std::mutex> lock(child_id_map_mutex);
-                            if (child_id_to_category_id[child_id] == res.category()->id()) {
-                                res.set_category(category);
-                                return true;
-                            }
+                            recording->record_category(category);
                         }
-                        return false; // filter out results from other categories
+                        return category;
                     });
+                next_forwarder->set_deadline(child_health ? child_health->deadline(child_id, CHILD_SCOPE_DEADLINE) : CHILD_SCOPE_DEADLINE);
             }
-            subsearch(child, query_string, department_id, filter_state, next_forwarder);
+
+            SearchMetadata metadata(search_metadata());
+            metadata.set_cardinality(VideoAggregatorScope::child_cardinality(child_id, surfacing, search_metadata().cardinality()));
+            // not every child honours the cardinality, so don't buffer more than that
+            next_forwarder->set_result_limit(metadata.cardinality());
+            if (child_health)
+            {
+                watch_child_health(child_health, child_id, *next_forwarder);
+            }
+            if (recording)
+            {
+                recording->record_child(*next_forwarder);
+            }
+
+            child_searches.dispatching(child_id, metadata, next_forwarder);
+            child_searches.track(subsearch(child, query_string, department_id, filter_state, metadata, next_forwarder), next_forwarder);
         }
     }
+    recording_guard.dispatched();
+    child_searches.dispatched();
 }
@@ -22,21 +22,42 @@
 #define VIDEOAGGREGATORQUERY_H_
 
 #include <unity/scopes/SearchQueryBase.h>
+#include <unity/scopes/QueryCtrlProxyFwd.h>
 #include <unity/scopes/ReplyProxyFwd.h>
 
+#include <memory>
+#include <vector>
+
+#include "../utils/aggregatorchildsearches.h"
+#include "../utils/childstats.h"
+
+class ChildHealthTracker;
+class SearchCoalescer;
+
 class VideoAggregatorQuery : public unity::scopes::SearchQueryBase
 {
 public:
     VideoAggregatorQuery(unity::scopes::CannedQuery const& query,
             unity::scopes::SearchMetadata const& hints,
-            unity::scopes::ChildScopeList const& scopes);
-    ~VideoAggregatorQuery();
+            unity::scopes::ChildScopeList const& scopes,
+            std::shared_ptr<ChildHealthTracker> const& child_health = nullptr,
+            std::shared_ptr<SearchCoalescer> const& coalescer = nullptr);
     virtual void cancelled() override;
 
     virtual void run(unity::scopes::SearchReplyProxy const& reply) override;
 
+    // per child timings of this query, in the order the children are shown
+    std::vector<ChildSearchStats> child_stats();
+
 private:
+    // run() minus the start of the query; a follower may do it again
+    // when the query it followed gets cancelled
+    void search(unity::scopes::SearchReplyProxy const& parent_reply);
+
     unity::scopes::ChildScopeList child_scopes;
+    // shared by the queries of the scope; may be null
+    std::shared_ptr<ChildHealthTracker> child_health;
+    AggregatorChildSearches child_searches;
 };
 
 #endif
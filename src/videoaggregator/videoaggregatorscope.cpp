@@ -25,9 +25,21 @@
 #include <unity/scopes/CategoryRenderer.h>
 #include "../utils/utils.h"
 #include "../utils/i18n.h"
+#include "../utils/childhealth.h"
+#include "../utils/sharedsearch.h"
+
+#include <algorithm>
+#include <iostream>
 
 using namespace unity::scopes;
 
+// a child is skipped after this many failed searches in a row,
+// and searched again as a probe once the cooldown is over
+static const unsigned CHILD_FAILURE_THRESHOLD = 3;
+static const std::chrono::seconds CHILD_COOLDOWN(60);
+// how long the surfacing results are reused
+static const std::chrono::seconds SURFACING_CACHE_TTL(30);
+
 const std::string VideoAggregatorScope::local_videos_scope =
 #ifdef CLICK_MODE
     "com.ubuntu.scopes.myvideos_myvideos";
@@ -42,21 +54,65 @@ const std::vector<std::string> VideoAggregatorScope::predefined_scopes {
     "com.ubuntu.scopes.vimeo_vimeo"
 };
 
+const int VideoAggregatorScope::surfacing_predefined_cardinality = 6;
+const int VideoAggregatorScope::surfacing_other_cardinality = 3;
+const int VideoAggregatorScope::search_predefined_cardinality = 20;
+const int VideoAggregatorScope::search_other_cardinality = 10;
+
+int VideoAggregatorScope::child_cardinality(std::string const& child_id, bool surfacing, int requested)
+{
+    if (child_id == local_videos_scope)
+    {
+        return requested;
+    }
+    const bool is_predefined_scope =
+        std::find(predefined_scopes.begin(), predefined_scopes.end(), child_id) != predefined_scopes.end();
+    int budget;
+    if (surfacing)
+    {
+        budget = is_predefined_scope ? surfacing_predefined_cardinality : surfacing_other_cardinality;
+    }
+    else
+    {
+        budget = is_predefined_scope ? search_predefined_cardinality : search_other_cardinality;
+    }
+    // the shell may ask for fewer results than that
+    if (requested > 0 && requested < budget)
+    {
+        return requested;
+    }
+    return budget;
+}
+
 void VideoAggregatorScope::start(std::string const&) {
     init_gettext(*this);
+    child_health = std::make_shared<ChildHealthTracker>(CHILD_FAILURE_THRESHOLD, CHILD_COOLDOWN);
+    coalescer = std::make_shared<SearchCoalescer>(SURFACING_CACHE_TTL);
+    child_discovery.reset(new ChildScopeDiscovery("videoaggregator", predefined_scopes, "videos"));
 }
 
 ChildScopeList VideoAggregatorScope::find_child_scopes() const
 {
+    if (child_discovery)
+    {
+        return child_discovery->find(registry());
+    }
     return find_child_scopes_by_keywords("videoaggregator", registry(), predefined_scopes, "videos");
 }
 
 void VideoAggregatorScope::stop() {
+    // stops the registry notifications
+    child_discovery.reset();
+    if (child_health)
+    {
+        std::cerr << "Child scope health:" << std::endl;
+        child_health->dump(std::cerr);
+    }
 }
 
 SearchQueryBase::UPtr VideoAggregatorScope::search(CannedQuery const& q,
                                                    SearchMetadata const& hints) {
-    SearchQueryBase::UPtr query(new VideoAggregatorQuery(q, hints, child_scopes()));
+    SearchQueryBase::UPtr query(new VideoAggregatorQuery(q, hints, child_scopes(), child_health, coalescer));
     return query;
 }
 
@@ -20,12 +20,19 @@
 #ifndef VIDEOAGGREGATORSCOPE_H
 #define VIDEOAGGREGATORSCOPE_H
 
+#include <memory>
+#include <string>
 #include <vector>
 
 #include <unity/scopes/ScopeBase.h>
 #include <unity/scopes/ScopeMetadata.h>
 #include <unity/scopes/ReplyProxyFwd.h>
 
+#include "../utils/utils.h"
+
+class ChildHealthTracker;
+class SearchCoalescer;
+
 class VideoAggregatorScope : public unity::scopes::ScopeBase
 {
 public:
@@ -43,6 +50,24 @@ public:
 
     static const std::string local_videos_scope;
     static const std::vector<std::string> predefined_scopes;
+
+    // number of results asked from each remote child: predefined scopes
+    // get their own category layout, keyword-discovered ones a smaller
+    // share of the page
+    static const int surfacing_predefined_cardinality;
+    static const int surfacing_other_cardinality;
+    static const int search_predefined_cardinality;
+    static const int search_other_cardinality;
+
+    // the cardinality to search child_id with when the shell asked for
+    // requested results (0 for no limit); the local videos scope is not
+    // limited beyond that
+    static int child_cardinality(std::string const& child_id, bool surfacing, int requested);
+
+private:
+    std::shared_ptr<ChildHealthTracker> child_health;
+    std::shared_ptr<SearchCoalescer> coalescer;
+    std::unique_ptr<ChildScopeDiscovery> child_discovery;
 };
 
 #endif
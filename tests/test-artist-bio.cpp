@@ -0,0 +1,280 @@
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <mediascanner/MediaFile.hh>
+#include <mediascanner/MediaFileBuilder.hh>
+#include <mediascanner/MediaStore.hh>
+#include <unity/scopes/testing/Category.h>
+#include <unity/scopes/testing/MockSearchReply.h>
+#include <unity/scopes/testing/TypedScopeFixture.h>
+
+#include "../src/mymusic/music-scope.h"
+
+using namespace mediascanner;
+using namespace unity::scopes;
+using ::testing::_;
+using ::testing::Invoke;
+using ::testing::Matcher;
+
+static const char BIOGRAPHY[] = "Spiderbait are an Australian rock band.";
+
+/* Stands in for the biography service on the loopback interface. Every
+   request gets the same biography; while held, the answers wait for the
+   test to release them. */
+class BioServer {
+public:
+    BioServer() {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            throw std::runtime_error(strerror(errno));
+        }
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            listen(fd, 8) != 0 ||
+            getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+            throw std::runtime_error(strerror(errno));
+        }
+        port = ntohs(addr.sin_port);
+        thread = std::thread([this]() { serve(); });
+    }
+
+    ~BioServer() {
+        release();
+        shutdown(fd, SHUT_RDWR);
+        thread.join();
+        close(fd);
+    }
+
+    std::string url() const {
+        return "http://127.0.0.1:" + std::to_string(port);
+    }
+
+    void hold() {
+        std::lock_guard<std::mutex> lock(mutex);
+        held = true;
+    }
+
+    void release() {
+        std::lock_guard<std::mutex> lock(mutex);
+        held = false;
+        changed.notify_all();
+    }
+
+    // request lines received so far
+    std::vector<std::string> requests() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return received;
+    }
+
+    unsigned answered() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return answers;
+    }
+
+private:
+    void serve() {
+        for (;;) {
+            const int client = accept(fd, nullptr, nullptr);
+            if (client < 0) {
+                return;
+            }
+            std::string request;
+            char buffer[1024];
+            while (request.find("\r\n\r\n") == std::string::npos) {
+                const ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+                if (n <= 0) {
+                    break;
+                }
+                request.append(buffer, n);
+            }
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                received.push_back(request.substr(0, request.find("\r\n")));
+                changed.wait_for(lock, std::chrono::seconds(5), [this]() { return !held; });
+                answers++;
+            }
+            const std::string body = std::string("{\"biography\": \"") + BIOGRAPHY + "\"}";
+            const std::string response = "HTTP/1.1 200 OK\r\n"
+                "Content-Type: application/json\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                "Connection: close\r\n\r\n" + body;
+            std::size_t sent = 0;
+            while (sent < response.size()) {
+                const ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0) {
+                    break;
+                }
+                sent += n;
+            }
+            close(client);
+        }
+    }
+
+    int fd = -1;
+    int port = 0;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool held = false;
+    std::vector<std::string> received;
+    unsigned answers = 0;
+};
+
+// started by main(), before any scope is created
+static std::unique_ptr<BioServer> bio_server;
+
+class LocalBioScope : public MusicScope {
+public:
+    LocalBioScope() : MusicScope(bio_server->url()) {}
+};
+
+class ArtistBioTest : public unity::scopes::testing::TypedScopeFixture<LocalBioScope> {
+protected:
+    virtual void SetUp() {
+        cachedir = "/tmp/mediastore.XXXXXX";
+        // mkdtemp edits the string in place without changing its length
+        if (mkdtemp(const_cast<char*>(cachedir.c_str())) == nullptr) {
+            throw std::runtime_error(strerror(errno));
+        }
+        ASSERT_EQ(0, setenv("MEDIASCANNER_CACHEDIR", cachedir.c_str(), 1));
+        populateStore();
+
+        set_scope_directory("/no/such/directory");
+        set_cache_directory(cachedir);
+        unity::scopes::testing::TypedScopeFixture<LocalBioScope>::SetUp();
+    }
+
+    virtual void TearDown() {
+        unity::scopes::testing::TypedScopeFixture<LocalBioScope>::TearDown();
+        bio_server->release();
+
+        if (!cachedir.empty()) {
+            std::string cmd = "rm -rf " + cachedir;
+            ASSERT_EQ(0, system(cmd.c_str()));
+        }
+    }
+
+    void populateStore() {
+        MediaStore store(MS_READ_WRITE);
+        {
+            MediaFileBuilder builder("/path/foo1.ogg");
+            builder.setType(AudioMedia);
+            builder.setTitle("Straight Through The Sun");
+            builder.setAuthor("Spiderbait");
+            builder.setAlbum("Spiderbait");
+            builder.setTrackNumber(1);
+            builder.setDuration(235);
+            store.insert(builder.build());
+        }
+        {
+            MediaFileBuilder builder("/path/foo2.ogg");
+            builder.setType(AudioMedia);
+            builder.setTitle("It's Beautiful");
+            builder.setAuthor("Spiderbait");
+            builder.setAlbum("Spiderbait");
+            builder.setTrackNumber(2);
+            builder.setDuration(220);
+            store.insert(builder.build());
+        }
+    }
+
+    // runs the artist page and returns the summary of its biography card;
+    // on_album is called as each album is pushed
+    std::string artistBio(SearchMetadata const& hints, std::function<void()> const& on_album = nullptr) {
+        CannedQuery q("mediascanner-music", "Spiderbait", "");
+        q.set_user_data(Variant("albums_of_artist"));
+        auto query = scope->search(q, hints);
+
+        unity::scopes::testing::MockSearchReply reply;
+        EXPECT_CALL(reply, register_departments(_));
+        EXPECT_CALL(reply, register_category(_, _, _, _))
+            .WillRepeatedly(Invoke([](std::string const& id, std::string const& title, std::string const& icon,
+                            CategoryRenderer const& renderer) -> Category::SCPtr {
+                        return std::make_shared<unity::scopes::testing::Category>(id, title, icon, renderer);
+                    }));
+        std::string bio;
+        unsigned bio_cards = 0;
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(_)))
+            .WillRepeatedly(Invoke([&bio, &bio_cards, &on_album](CategorisedResult const& res) -> bool {
+                        if (res.category()->id() == "bio") {
+                            bio = res["summary"].get_string();
+                            bio_cards++;
+                        } else if (res.category()->id() == "albums" && on_album) {
+                            on_album();
+                        }
+                        return true;
+                    }));
+
+        SearchReplyProxy proxy(&reply, [](SearchReply*){});
+        query->run(proxy);
+        EXPECT_EQ(1u, bio_cards);
+        return bio;
+    }
+
+    std::string cachedir;
+};
+
+/* The biography is downloaded while the albums are pushed */
+TEST_F(ArtistBioTest, FetchedInBackground) {
+    const auto before = bio_server->requests().size();
+    bio_server->hold();
+    unsigned answered_before_albums = 0;
+    auto const bio = artistBio(SearchMetadata("en_AU", "phone"), [&answered_before_albums]() {
+            answered_before_albums += bio_server->answered();
+            bio_server->release();
+        });
+    EXPECT_EQ(0u, answered_before_albums);
+    EXPECT_EQ(BIOGRAPHY, bio);
+
+    auto const requests = bio_server->requests();
+    ASSERT_EQ(before + 1, requests.size());
+    EXPECT_NE(std::string::npos, requests.back().find("/musicproxy/v1/artist-bio?"));
+    EXPECT_NE(std::string::npos, requests.back().find("artist=Spiderbait"));
+}
+
+/* Once cached, the biography is served without a request */
+TEST_F(ArtistBioTest, Cached) {
+    const auto before = bio_server->requests().size();
+    EXPECT_EQ(BIOGRAPHY, artistBio(SearchMetadata("en_AU", "phone")));
+    EXPECT_EQ(before + 1, bio_server->requests().size());
+
+    EXPECT_EQ(BIOGRAPHY, artistBio(SearchMetadata("en_AU", "phone")));
+    EXPECT_EQ(before + 1, bio_server->requests().size());
+}
+
+TEST_F(ArtistBioTest, Disconnected) {
+    const auto before = bio_server->requests().size();
+    SearchMetadata hints("en_AU", "phone");
+    hints.set_internet_connectivity(QueryMetadata::ConnectivityStatus::Disconnected);
+    EXPECT_EQ("", artistBio(hints));
+    EXPECT_EQ(before, bio_server->requests().size());
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    bio_server.reset(new BioServer);
+    const int result = RUN_ALL_TESTS();
+    bio_server.reset();
+    return result;
+}
@@ -0,0 +1,82 @@
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <core/signal.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <unity/scopes/testing/MockRegistry.h>
+#include <unity/scopes/testing/MockScope.h>
+#include <unity/scopes/testing/ScopeMetadataBuilder.h>
+
+#include "../src/utils/utils.h"
+
+using namespace unity::scopes;
+using ::testing::_;
+using ::testing::Invoke;
+using ::testing::Return;
+
+class ChildDiscoveryTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        proxy = RegistryProxy(&registry, [](Registry*){});
+        EXPECT_CALL(registry, set_list_update_callback(_))
+            .WillOnce(Invoke([this](std::function<void()> callback) {
+                        return list_updated.connect(callback);
+                    }));
+    }
+
+    ScopeMetadata metadata(std::string const& scope_id) {
+        return unity::scopes::testing::ScopeMetadataBuilder()
+            .scope_id(scope_id)
+            .display_name(" ").description(" ")
+            .author(" ")
+            .proxy(ScopeProxy(scope))();
+    }
+
+    std::shared_ptr<unity::scopes::testing::MockScope> scope {
+        new unity::scopes::testing::MockScope("child", "child")};
+    unity::scopes::testing::MockRegistry registry;
+    RegistryProxy proxy;
+    core::Signal<> list_updated;
+};
+
+/* The registry is only asked again once it reports a change */
+TEST_F(ChildDiscoveryTest, RebuiltOnListUpdate) {
+    const MetadataMap before {{"com.ubuntu.scopes.youtube_youtube", metadata("com.ubuntu.scopes.youtube_youtube")}};
+    const MetadataMap after {
+        {"com.ubuntu.scopes.youtube_youtube", metadata("com.ubuntu.scopes.youtube_youtube")},
+        {"com.example.scopes.videos_videos", metadata("com.example.scopes.videos_videos")},
+    };
+    EXPECT_CALL(registry, list_if(_))
+        .WillOnce(Return(before))
+        .WillOnce(Return(after));
+
+    ChildScopeDiscovery discovery("videoaggregator", {"com.ubuntu.scopes.youtube_youtube"}, "videos");
+    EXPECT_EQ(1u, discovery.find(proxy).size());
+    EXPECT_EQ(1u, discovery.find(proxy).size());
+
+    list_updated();
+    auto const children = discovery.find(proxy);
+    ASSERT_EQ(2u, children.size());
+    // predefined scopes come first
+    EXPECT_EQ("com.ubuntu.scopes.youtube_youtube", children[0].id);
+    EXPECT_EQ("com.example.scopes.videos_videos", children[1].id);
+    EXPECT_EQ(2u, discovery.find(proxy).size());
+}
+
+/* Notifications arriving once the discovery is gone are not delivered */
+TEST_F(ChildDiscoveryTest, DisconnectedWhenDestroyed) {
+    EXPECT_CALL(registry, list_if(_))
+        .WillOnce(Return(MetadataMap()));
+    {
+        ChildScopeDiscovery discovery("videoaggregator", {"com.ubuntu.scopes.youtube_youtube"}, "videos");
+        EXPECT_TRUE(discovery.find(proxy).empty());
+    }
+    list_updated();
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,124 @@
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include <gtest/gtest.h>
+#include <unity/scopes/CompletionDetails.h>
+#include <unity/scopes/testing/MockSearchReply.h>
+
+#include "../src/utils/bufferedresultforwarder.h"
+#include "../src/utils/childhealth.h"
+
+using namespace unity::scopes;
+
+TEST(ChildHealthTest, SkipsFailingChild) {
+    ChildHealthTracker tracker(2, std::chrono::milliseconds(100));
+    EXPECT_TRUE(tracker.should_search("child"));
+    tracker.record("child", std::chrono::milliseconds(20), true);
+    EXPECT_TRUE(tracker.should_search("child"));
+    tracker.record("child", std::chrono::milliseconds(40), true);
+
+    EXPECT_FALSE(tracker.should_search("child"));
+    EXPECT_TRUE(tracker.should_search("other"));
+
+    auto const stats = tracker.stats("child");
+    EXPECT_EQ(2u, stats.searches);
+    EXPECT_EQ(2u, stats.failures);
+    EXPECT_EQ(1u, stats.skipped);
+    EXPECT_TRUE(stats.skipping);
+    EXPECT_DOUBLE_EQ(24.0, stats.latency_ms);
+}
+
+/* After the cooldown a single query probes the child again */
+TEST(ChildHealthTest, ProbesAfterCooldown) {
+    ChildHealthTracker tracker(1, std::chrono::milliseconds(50));
+    tracker.record("child", std::chrono::milliseconds(10), true);
+    EXPECT_FALSE(tracker.should_search("child"));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_TRUE(tracker.should_search("child"));
+    EXPECT_FALSE(tracker.should_search("child"));
+
+    // a failed probe opens the circuit again
+    tracker.record("child", std::chrono::milliseconds(10), true);
+    EXPECT_FALSE(tracker.should_search("child"));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_TRUE(tracker.should_search("child"));
+    tracker.record("child", std::chrono::milliseconds(10), false);
+    EXPECT_TRUE(tracker.should_search("child"));
+    EXPECT_TRUE(tracker.should_search("child"));
+    EXPECT_FALSE(tracker.stats("child").skipping);
+}
+
+TEST(ChildHealthTest, WatchForwarder) {
+    unity::scopes::testing::MockSearchReply reply;
+    SearchReplyProxy proxy(&reply, [](SearchReply*){});
+    auto tracker = std::make_shared<ChildHealthTracker>(3, std::chrono::seconds(10));
+
+    auto failed = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+    watch_child_health(tracker, "failed", *failed);
+    failed->finished(CompletionDetails(CompletionDetails::Error));
+    EXPECT_EQ(1u, tracker->stats("failed").failures);
+
+    // cancelled by the aggregator: not the child's fault
+    auto cancelled = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+    watch_child_health(tracker, "cancelled", *cancelled);
+    cancelled->finished(CompletionDetails(CompletionDetails::Cancelled));
+    EXPECT_EQ(0u, tracker->stats("cancelled").searches);
+
+    // missing the deadline only counts as latency
+    auto slow = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+    watch_child_health(tracker, "slow", *slow);
+    slow->set_deadline(std::chrono::milliseconds(10));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    slow->finished(CompletionDetails(CompletionDetails::OK));
+    EXPECT_EQ(1u, tracker->stats("slow").searches);
+    EXPECT_EQ(0u, tracker->stats("slow").failures);
+    EXPECT_GE(tracker->stats("slow").latency_ms, 100.0);
+
+    // still running past the deadline when the query is cancelled: it
+    // never finished
+    auto stuck = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+    watch_child_health(tracker, "stuck", *stuck);
+    stuck->set_deadline(std::chrono::milliseconds(10));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    stuck->finished(CompletionDetails(CompletionDetails::Cancelled));
+    EXPECT_EQ(1u, tracker->stats("stuck").failures);
+}
+
+/* A cancelled probe waits for another cooldown */
+TEST(ChildHealthTest, CancelledProbe) {
+    ChildHealthTracker tracker(1, std::chrono::milliseconds(50));
+    tracker.record("child", std::chrono::milliseconds(10), true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_TRUE(tracker.should_search("child"));
+
+    tracker.record_cancelled("child");
+    EXPECT_FALSE(tracker.should_search("child"));
+    EXPECT_TRUE(tracker.stats("child").skipping);
+    EXPECT_EQ(1u, tracker.stats("child").searches);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_TRUE(tracker.should_search("child"));
+
+    // cancelling a child that isn't probed changes nothing
+    tracker.record_cancelled("other");
+    EXPECT_TRUE(tracker.should_search("other"));
+}
+
+/* Children that are usually late hold up the page for less time */
+TEST(ChildHealthTest, SlowChildDeadline) {
+    ChildHealthTracker tracker(3, std::chrono::seconds(10));
+    const std::chrono::milliseconds deadline(2500);
+    EXPECT_EQ(deadline, tracker.deadline("child", deadline));
+
+    tracker.record("child", std::chrono::milliseconds(4000), false);
+    EXPECT_EQ(std::chrono::milliseconds(1250), tracker.deadline("child", deadline));
+    EXPECT_TRUE(tracker.should_search("child"));
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
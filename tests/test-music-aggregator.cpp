@@ -168,6 +168,51 @@ TEST(TestMusicAgregator, TestSpecificSearch) {
     query.run(proxy);
 }
 
+TEST(TestMusicAgregator, TestCancelPropagates) {
+
+    CannedQuery q("mediascanner-music", "test", "");
+    SearchMetadata hints("en_AU", "phone");
+
+    std::shared_ptr<unity::scopes::testing::MockScope> soundcloud_scope(new unity::scopes::testing::MockScope("2", "2"));
+    std::shared_ptr<unity::scopes::testing::MockScope> local_scope(new unity::scopes::testing::MockScope("6", "6"));
+
+    unity::scopes::ChildScopeList child_scopes {
+        {"mediascanner-music", unity::scopes::testing::ScopeMetadataBuilder()
+            .scope_id("mediascanner-music")
+                .display_name(" ").description(" ")
+                .author(" ")
+                .proxy(unity::scopes::ScopeProxy(local_scope))()},
+        {"com.ubuntu.scopes.soundcloud_soundcloud", unity::scopes::testing::ScopeMetadataBuilder()
+            .scope_id("com.ubuntu.scopes.soundcloud_soundcloud")
+                .display_name(" ").description(" ")
+                .author(" ")
+                .proxy(unity::scopes::ScopeProxy(soundcloud_scope))()},
+    };
+
+    MusicAggregatorQuery query(q, hints, child_scopes);
+
+    unity::scopes::testing::MockSearchReply reply;
+    Category::SCPtr category = std::make_shared<unity::scopes::testing::Category>(
+        "soundcloud", "Tracks", "icon", CategoryRenderer());
+    EXPECT_CALL(reply, register_category(_, _, _, _))
+        .WillRepeatedly(Return(category));
+    EXPECT_CALL(reply, register_category(_, _, _, _, _))
+        .WillRepeatedly(Return(category));
+
+    std::shared_ptr<unity::scopes::testing::MockQueryCtrl> local_ctrl(new unity::scopes::testing::MockQueryCtrl());
+    std::shared_ptr<unity::scopes::testing::MockQueryCtrl> soundcloud_ctrl(new unity::scopes::testing::MockQueryCtrl());
+    EXPECT_CALL(*local_scope.get(), search("test", "", _, _, _)).WillOnce(Return(local_ctrl));
+    EXPECT_CALL(*soundcloud_scope.get(), search("test", "", _, _, _)).WillOnce(Return(soundcloud_ctrl));
+
+    SearchReplyProxy proxy(&reply, [](SearchReply*){});
+    query.run(proxy);
+
+    // every child search is cancelled along with the aggregator query
+    EXPECT_CALL(*local_ctrl.get(), cancel());
+    EXPECT_CALL(*soundcloud_ctrl.get(), cancel());
+    query.cancelled();
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
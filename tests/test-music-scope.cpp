@@ -1,13 +1,20 @@
+#include <algorithm>
 #include <cerrno>
+#include <chrono>
 #include <cstring>
+#include <fstream>
+#include <iostream>
 #include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <mediascanner/MediaFile.hh>
 #include <mediascanner/MediaFileBuilder.hh>
 #include <mediascanner/MediaStore.hh>
+#include <unity/scopes/Department.h>
 #include <unity/scopes/testing/Category.h>
 #include <unity/scopes/testing/MockPreviewReply.h>
 #include <unity/scopes/testing/MockSearchReply.h>
@@ -15,12 +22,15 @@
 #include <unity/scopes/testing/TypedScopeFixture.h>
 
 #include "../src/mymusic/music-scope.h"
+#include "../src/utils/storegeneration.h"
 
 using namespace mediascanner;
 using namespace unity::scopes;
 using ::testing::_;
 using ::testing::AllOf;
 using ::testing::ElementsAre;
+using ::testing::InSequence;
+using ::testing::Invoke;
 using ::testing::Matcher;
 using ::testing::Property;
 using ::testing::Return;
@@ -38,6 +48,7 @@ protected:
         store.reset(new MediaStore(MS_READ_WRITE));
 
         set_scope_directory("/no/such/directory");
+        set_cache_directory(cachedir);
         unity::scopes::testing::TypedScopeFixture<MusicScope>::SetUp();
     }
 
@@ -138,6 +149,37 @@ protected:
         }
     }
 
+    // titles of the artists on the surfacing page
+    std::vector<std::string> surfacingTitles() {
+        Category::SCPtr artists_category = std::make_shared<unity::scopes::testing::Category>(
+            "artists", "Artists", "icon", CategoryRenderer());
+        auto query = scope->search(CannedQuery("mediascanner-music", "", ""), SearchMetadata("en_AU", "phone"));
+        unity::scopes::testing::MockSearchReply reply;
+        EXPECT_CALL(reply, register_departments(_));
+        EXPECT_CALL(reply, register_category("artists", _, _, _))
+            .WillOnce(Return(artists_category));
+        std::vector<std::string> titles;
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(_)))
+            .WillRepeatedly(Invoke([&titles](CategorisedResult const& res) -> bool {
+                        titles.push_back(res.title());
+                        return true;
+                    }));
+
+        SearchReplyProxy proxy(&reply, [](SearchReply*){});
+        query->run(proxy);
+        return titles;
+    }
+
+    std::string readWarmStartCache() {
+        std::ifstream in(cachedir + "/warm-start.cache", std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    void writeWarmStartCache(std::string const& data) {
+        std::ofstream out(cachedir + "/warm-start.cache", std::ios::binary | std::ios::trunc);
+        out << data;
+    }
+
     std::string cachedir;
     std::unique_ptr<MediaStore> store;
 };
@@ -151,6 +193,11 @@ MATCHER_P2(ResultProp, prop, value, "") {
     return arg.contains(prop) && arg[prop] == unity::scopes::Variant(value);
 }
 
+MATCHER_P(ResultArtContains, text, "") {
+    *result_listener << "result.art is " << arg.art();
+    return arg.art().find(text) != std::string::npos;
+}
+
 MATCHER_P(ResultUriMatchesCannedQuery, q, "") {
     *result_listener << "result.uri is " << arg.uri();
     auto const query = unity::scopes::CannedQuery::from_uri(arg.uri());
@@ -220,6 +267,87 @@ TEST_F(MusicScopeTest, QueryResult) {
     query->run(proxy);
 }
 
+MATCHER_P(ResultInCategory, id, "") {
+    *result_listener << "result category is " << arg.category()->id();
+    return arg.category()->id() == id;
+}
+
+/* The artist, album and song lookups run concurrently, but results still
+ * arrive in category order */
+TEST_F(MusicScopeTest, SearchResultsInCategoryOrder) {
+    populateStore();
+
+    CannedQuery q("mediascanner-music", "road", "");
+    SearchMetadata hints("en_AU", "phone");
+    auto query = scope->search(q, hints);
+
+    Category::SCPtr artists_category = std::make_shared<unity::scopes::testing::Category>(
+        "artists", "Artists", "icon", CategoryRenderer());
+    Category::SCPtr songs_category = std::make_shared<unity::scopes::testing::Category>(
+        "songs", "Tracks", "icon", CategoryRenderer());
+    Category::SCPtr albums_category = std::make_shared<unity::scopes::testing::Category>(
+        "albums", "Albums", "icon", CategoryRenderer());
+    unity::scopes::testing::MockSearchReply reply;
+    EXPECT_CALL(reply, register_category("artists", _, _, _))
+        .WillOnce(Return(artists_category));
+    EXPECT_CALL(reply, register_category("songs", _, _, _))
+        .WillOnce(Return(songs_category));
+    EXPECT_CALL(reply, register_category("albums", _, _, _))
+        .WillOnce(Return(albums_category));
+
+    {
+        InSequence s;
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(ResultInCategory("artists"))))
+            .WillOnce(Return(true));
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(ResultInCategory("albums"))))
+            .WillOnce(Return(true));
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(ResultInCategory("songs"))))
+            .WillOnce(Return(true));
+    }
+
+    SearchReplyProxy proxy(&reply, [](SearchReply*){});
+    query->run(proxy);
+}
+
+/* More searches than pooled connections must all complete */
+TEST_F(MusicScopeTest, ConcurrentSearches) {
+    populateStore();
+
+    const int n_queries = 6;
+    Category::SCPtr category = std::make_shared<unity::scopes::testing::Category>(
+        "mymusic", "My Music", "icon", CategoryRenderer());
+    std::vector<std::unique_ptr<unity::scopes::testing::MockSearchReply>> replies;
+    std::vector<SearchQueryBase::UPtr> queries;
+    for (int i = 0; i < n_queries; i++)
+    {
+        CannedQuery q("mediascanner-music", "road", "");
+        SearchMetadata hints("en_AU", "phone");
+        hints.set_aggregated_keywords({"music"});
+        queries.push_back(scope->search(q, hints));
+
+        replies.emplace_back(new unity::scopes::testing::MockSearchReply);
+        auto &reply = *replies.back();
+        EXPECT_CALL(reply, register_category("mymusic", _, _, _, _))
+            .WillOnce(Return(category));
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(_)))
+            .Times(3)
+            .WillRepeatedly(Return(true));
+    }
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n_queries; i++)
+    {
+        threads.emplace_back([&queries, &replies, i]() {
+                SearchReplyProxy proxy(replies[i].get(), [](SearchReply*){});
+                queries[i]->run(proxy);
+            });
+    }
+    for (auto &t: threads)
+    {
+        t.join();
+    }
+}
+
 /* Check that we get some results for a short query */
 TEST_F(MusicScopeTest, ShortQuery) {
     populateStore();
@@ -299,6 +427,281 @@ TEST_F(MusicScopeTest, SurfacingQuery) {
     query->run(proxy);
 }
 
+/* Benchmark of a warm start up to the first surfacing result; the times
+   are only recorded, they depend on the machine running the tests */
+TEST_F(MusicScopeTest, StartupTime) {
+    populateStore();
+    EXPECT_THAT(surfacingTitles(), ElementsAre("Spiderbait", "The John Butler Trio"));
+    scope->stop();
+
+    typedef std::chrono::steady_clock clock;
+    auto const start = clock::now();
+    scope->start("mediascanner-music");
+    auto const started = clock::now();
+
+    auto query = scope->search(CannedQuery("mediascanner-music", "", ""), SearchMetadata("en_AU", "phone"));
+    Category::SCPtr artists_category = std::make_shared<unity::scopes::testing::Category>(
+        "artists", "Artists", "icon", CategoryRenderer());
+    unity::scopes::testing::MockSearchReply reply;
+    EXPECT_CALL(reply, register_departments(_));
+    EXPECT_CALL(reply, register_category("artists", _, _, _))
+        .WillOnce(Return(artists_category));
+    clock::time_point first_result;
+    unsigned long checkouts = 0;
+    EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(_)))
+        .Times(2)
+        .WillRepeatedly(Invoke([this, &first_result, &checkouts](CategorisedResult const&) -> bool {
+                    if (first_result == clock::time_point()) {
+                        first_result = clock::now();
+                        checkouts = scope->store_stats().checkouts;
+                    }
+                    return true;
+                }));
+
+    SearchReplyProxy proxy(&reply, [](SearchReply*){});
+    query->run(proxy);
+    // the first page comes from the warm start cache alone
+    EXPECT_EQ(0u, checkouts);
+
+    auto const start_us = std::chrono::duration_cast<std::chrono::microseconds>(started - start).count();
+    auto const first_result_us = std::chrono::duration_cast<std::chrono::microseconds>(first_result - start).count();
+    RecordProperty("start_us", start_us);
+    RecordProperty("first_result_us", first_result_us);
+    std::cout << "start: " << start_us << "us, first result: " << first_result_us << "us" << std::endl;
+}
+
+/* The surfacing page of the previous run is served without a store query */
+TEST_F(MusicScopeTest, WarmStartCache) {
+    populateStore();
+    EXPECT_THAT(surfacingTitles(), ElementsAre("Spiderbait", "The John Butler Trio"));
+    scope->stop();
+    ASSERT_FALSE(readWarmStartCache().empty());
+
+    scope->start("mediascanner-music");
+    EXPECT_THAT(surfacingTitles(), ElementsAre("Spiderbait", "The John Butler Trio"));
+    EXPECT_EQ(0u, scope->store_stats().checkouts);
+}
+
+/* The database changed while the scope wasn't running */
+TEST_F(MusicScopeTest, WarmStartCacheOutOfDate) {
+    populateStore();
+    EXPECT_THAT(surfacingTitles(), ElementsAre("Spiderbait", "The John Butler Trio"));
+    scope->stop();
+    {
+        MediaFileBuilder builder("/path/foo8.ogg");
+        builder.setType(AudioMedia);
+        builder.setTitle("Sunshine");
+        builder.setAuthor("Atmosphere");
+        builder.setAlbum("Lucy Ford");
+        builder.setTrackNumber(1);
+        builder.setDuration(250);
+        store->insert(builder.build());
+    }
+
+    scope->start("mediascanner-music");
+    EXPECT_THAT(surfacingTitles(), ElementsAre("Atmosphere", "Spiderbait", "The John Butler Trio"));
+    EXPECT_NE(0u, scope->store_stats().checkouts);
+}
+
+TEST_F(MusicScopeTest, WarmStartCacheTruncated) {
+    populateStore();
+    EXPECT_THAT(surfacingTitles(), ElementsAre("Spiderbait", "The John Butler Trio"));
+    scope->stop();
+    auto const data = readWarmStartCache();
+    ASSERT_GT(data.size(), 16u);
+
+    // cut in the middle of the snapshot, then with a bogus artist count
+    for (auto const& corrupt: {data.substr(0, data.size() / 2),
+                data.substr(0, 16) + std::string(4, '\xff') + data.substr(20)}) {
+        writeWarmStartCache(corrupt);
+        scope->start("mediascanner-music");
+        EXPECT_THAT(surfacingTitles(), ElementsAre("Spiderbait", "The John Butler Trio"));
+        EXPECT_NE(0u, scope->store_stats().checkouts);
+        scope->stop();
+    }
+}
+
+TEST_F(MusicScopeTest, WarmStartCacheUnknownFormat) {
+    populateStore();
+    EXPECT_THAT(surfacingTitles(), ElementsAre("Spiderbait", "The John Butler Trio"));
+    scope->stop();
+    auto const data = readWarmStartCache();
+    ASSERT_GT(data.size(), 8u);
+
+    // the magic number, then the version
+    for (std::size_t offset: {0u, 4u}) {
+        auto corrupt = data;
+        corrupt[offset] = ~corrupt[offset];
+        writeWarmStartCache(corrupt);
+        scope->start("mediascanner-music");
+        EXPECT_THAT(surfacingTitles(), ElementsAre("Spiderbait", "The John Butler Trio"));
+        EXPECT_NE(0u, scope->store_stats().checkouts);
+        scope->stop();
+    }
+}
+
+TEST_F(MusicScopeTest, SurfacingArtistArt) {
+    populateStore();
+
+    Category::SCPtr artists_category = std::make_shared<unity::scopes::testing::Category>(
+        "artists", "Artists", "icon", CategoryRenderer());
+    {
+        auto query = scope->search(CannedQuery("mediascanner-music", "", ""), SearchMetadata("en_AU", "phone"));
+        unity::scopes::testing::MockSearchReply reply;
+        EXPECT_CALL(reply, register_departments(_));
+        EXPECT_CALL(reply, register_category("artists", _, _, _))
+            .WillOnce(Return(artists_category));
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(AllOf(
+                ResultProp("title", "Spiderbait"),
+                ResultArtContains("album=Ivy")))))
+            .WillOnce(Return(true));
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(AllOf(
+                ResultProp("title", "The John Butler Trio"),
+                ResultArtContains("album=April")))))
+            .WillOnce(Return(true));
+
+        SearchReplyProxy proxy(&reply, [](SearchReply*){});
+        query->run(proxy);
+    }
+
+    // the artist index picks up artists added after it was built
+    {
+        MediaFileBuilder builder("/path/foo8.ogg");
+        builder.setType(AudioMedia);
+        builder.setTitle("Sunshine");
+        builder.setAuthor("Atmosphere");
+        builder.setAlbum("Lucy Ford");
+        builder.setTrackNumber(1);
+        builder.setDuration(250);
+        store->insert(builder.build());
+    }
+    // the page is served from the previous snapshot while a new one is
+    // built in the background
+    {
+        auto query = scope->search(CannedQuery("mediascanner-music", "", ""), SearchMetadata("en_AU", "phone"));
+        unity::scopes::testing::MockSearchReply reply;
+        EXPECT_CALL(reply, register_departments(_));
+        EXPECT_CALL(reply, register_category("artists", _, _, _))
+            .WillOnce(Return(artists_category));
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(ResultProp("title", "Spiderbait"))))
+            .WillOnce(Return(true));
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(ResultProp("title", "The John Butler Trio"))))
+            .WillOnce(Return(true));
+
+        SearchReplyProxy proxy(&reply, [](SearchReply*){});
+        query->run(proxy);
+    }
+    std::vector<std::string> titles;
+    std::string new_artist_art;
+    for (int attempt = 0; attempt < 200 && new_artist_art.empty(); attempt++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        titles.clear();
+        auto query = scope->search(CannedQuery("mediascanner-music", "", ""), SearchMetadata("en_AU", "phone"));
+        unity::scopes::testing::MockSearchReply reply;
+        EXPECT_CALL(reply, register_departments(_));
+        EXPECT_CALL(reply, register_category("artists", _, _, _))
+            .WillOnce(Return(artists_category));
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(_)))
+            .WillRepeatedly(Invoke([&titles, &new_artist_art](CategorisedResult const& res) -> bool {
+                        titles.push_back(res.title());
+                        if (res.title() == "Atmosphere") {
+                            new_artist_art = res.art();
+                        }
+                        return true;
+                    }));
+
+        SearchReplyProxy proxy(&reply, [](SearchReply*){});
+        query->run(proxy);
+    }
+    EXPECT_THAT(titles, ElementsAre("Atmosphere", "Spiderbait", "The John Butler Trio"));
+    EXPECT_NE(std::string::npos, new_artist_art.find("album=Lucy"));
+}
+
+TEST_F(MusicScopeTest, CancelledArtistsQuery) {
+    populateStore();
+    for (int i = 0; i < 200; i++) {
+        const std::string n = std::to_string(i);
+        MediaFileBuilder builder("/path/many" + n + ".ogg");
+        builder.setType(AudioMedia);
+        builder.setTitle("Song " + n);
+        builder.setAuthor("Artist " + n);
+        builder.setAlbum("Album " + n);
+        builder.setDuration(100);
+        store->insert(builder.build());
+    }
+
+    CannedQuery q("mediascanner-music", "", "");
+    SearchMetadata hints("en_AU", "phone");
+    auto query = scope->search(q, hints);
+
+    Category::SCPtr artists_category = std::make_shared<unity::scopes::testing::Category>(
+        "artists", "Artists", "icon", CategoryRenderer());
+    unity::scopes::testing::MockSearchReply reply;
+    EXPECT_CALL(reply, register_departments(_));
+    EXPECT_CALL(reply, register_category("artists", _, _, _))
+        .WillOnce(Return(artists_category));
+
+    // the shell cancels the query while results are coming in
+    int pushed = 0;
+    EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(_)))
+        .Times(10)
+        .WillRepeatedly(Invoke([&query, &pushed](CategorisedResult const&) -> bool {
+                    if (++pushed == 10) {
+                        query->cancelled();
+                    }
+                    return true;
+                }));
+
+    SearchReplyProxy proxy(&reply, [](SearchReply*){});
+    query->run(proxy);
+}
+
+/* The artist biography doesn't hold up the albums and tracks */
+TEST_F(MusicScopeTest, AlbumsOfArtistBioLast) {
+    populateStore();
+
+    CannedQuery q("mediascanner-music", "The John Butler Trio", "");
+    q.set_user_data(Variant("albums_of_artist"));
+    SearchMetadata hints("en_AU", "phone");
+    auto query = scope->search(q, hints);
+
+    Category::SCPtr bio_category = std::make_shared<unity::scopes::testing::Category>(
+        "bio", "", "icon", CategoryRenderer());
+    Category::SCPtr albums_category = std::make_shared<unity::scopes::testing::Category>(
+        "albums", "Albums", "icon", CategoryRenderer());
+    Category::SCPtr songs_category = std::make_shared<unity::scopes::testing::Category>(
+        "songs", "Tracks", "icon", CategoryRenderer());
+    unity::scopes::testing::MockSearchReply reply;
+    EXPECT_CALL(reply, register_departments(_));
+    {
+        // registration order is display order
+        InSequence s;
+        EXPECT_CALL(reply, register_category("bio", _, _, _))
+            .WillOnce(Return(bio_category));
+        EXPECT_CALL(reply, register_category("albums", _, _, _))
+            .WillOnce(Return(albums_category));
+        EXPECT_CALL(reply, register_category("songs", _, _, _))
+            .WillOnce(Return(songs_category));
+    }
+    {
+        InSequence s;
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(ResultInCategory("albums"))))
+            .Times(2)
+            .WillRepeatedly(Return(true));
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(ResultInCategory("songs"))))
+            .Times(4)
+            .WillRepeatedly(Return(true));
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(AllOf(
+                ResultInCategory("bio"),
+                ResultArtContains("artist=The")))))
+            .WillOnce(Return(true));
+    }
+
+    SearchReplyProxy proxy(&reply, [](SearchReply*){});
+    query->run(proxy);
+}
+
 TEST_F(MusicScopeTest, TracksDepartmentSurfacing) {
     populateStore();
 
@@ -332,6 +735,47 @@ TEST_F(MusicScopeTest, TracksDepartmentSurfacing) {
     query->run(proxy);
 }
 
+TEST_F(MusicScopeTest, TracksSurfacingPlaylist) {
+    populateStore();
+
+    CannedQuery q("mediascanner-music", "", "tracks");
+    SearchMetadata hints("en_AU", "phone");
+    auto query = scope->search(q, hints);
+
+    Category::SCPtr songs_category = std::make_shared<unity::scopes::testing::Category>(
+        "songs", "Tracks", "icon", CategoryRenderer());
+    unity::scopes::testing::MockSearchReply reply;
+    EXPECT_CALL(reply, register_departments(_));
+    EXPECT_CALL(reply, register_category("songs", _, _, _))
+        .WillOnce(Return(songs_category));
+
+    std::vector<CategorisedResult> cards;
+    EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(_)))
+        .Times(7)
+        .WillRepeatedly(Invoke([&cards](CategorisedResult const& res) -> bool {
+                    cards.push_back(res);
+                    return true;
+                }));
+
+    SearchReplyProxy proxy(&reply, [](SearchReply*){});
+    query->run(proxy);
+
+    // the first card carries the playlist of all the songs, and every
+    // card refers to it
+    ASSERT_EQ(7u, cards.size());
+    const auto playlist = cards[0]["audio-data"].get_dict().at("playlist").get_array();
+    EXPECT_EQ(7u, playlist.size());
+    const auto playlist_id = cards[0]["audio-data"].get_dict().at("playlist-id").get_string();
+    EXPECT_FALSE(playlist_id.empty());
+    for (unsigned i = 0; i < cards.size(); i++) {
+        const auto data = cards[i]["audio-data"].get_dict();
+        EXPECT_EQ(cards[i].uri(), data.at("uri").get_string());
+        EXPECT_EQ(playlist_id, data.at("playlist-id").get_string());
+        EXPECT_EQ(i == 0, data.count("playlist") == 1);
+        EXPECT_NE(playlist.end(), std::find(playlist.begin(), playlist.end(), Variant(cards[i].uri())));
+    }
+}
+
 TEST_F(MusicScopeTest, GenresDepartmentSurfacing) {
     populateStore();
 
@@ -360,6 +804,114 @@ TEST_F(MusicScopeTest, GenresDepartmentSurfacing) {
     query->run(proxy);
 }
 
+static bool has_genre_department(Department::SCPtr const& root, std::string const& genre) {
+    for (auto const& dept: root->subdepartments()) {
+        if (dept->id() != "genres") {
+            continue;
+        }
+        for (auto const& subdept: dept->subdepartments()) {
+            if (subdept->id() == "genre:" + genre) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+TEST_F(MusicScopeTest, GenreDepartmentsFollowStore) {
+    populateStore();
+
+    Category::SCPtr albums_category = std::make_shared<unity::scopes::testing::Category>(
+        "albums", "", "icon", CategoryRenderer());
+    {
+        auto query = scope->search(CannedQuery("mediascanner-music", "", "genre:Rock"), SearchMetadata("en_AU", "phone"));
+        unity::scopes::testing::MockSearchReply reply;
+        EXPECT_CALL(reply, register_departments(Truly([](Department::SCPtr const& root) -> bool {
+                        return has_genre_department(root, "Rock") && !has_genre_department(root, "Jazz");
+                    })));
+        EXPECT_CALL(reply, register_category("albums", _, _, _))
+            .WillOnce(Return(albums_category));
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(_)))
+            .WillRepeatedly(Return(true));
+
+        SearchReplyProxy proxy(&reply, [](SearchReply*){});
+        query->run(proxy);
+    }
+
+    // the cached genre list is refreshed once the database changes
+    {
+        MediaFileBuilder builder("/path/foo8.ogg");
+        builder.setType(AudioMedia);
+        builder.setGenre("Jazz");
+        builder.setTitle("So What");
+        builder.setAuthor("Miles Davis");
+        builder.setAlbum("Kind of Blue");
+        builder.setTrackNumber(1);
+        builder.setDuration(562);
+        store->insert(builder.build());
+    }
+    {
+        auto query = scope->search(CannedQuery("mediascanner-music", "", "genre:Rock"), SearchMetadata("en_AU", "phone"));
+        unity::scopes::testing::MockSearchReply reply;
+        EXPECT_CALL(reply, register_departments(Truly([](Department::SCPtr const& root) -> bool {
+                        return has_genre_department(root, "Rock") && has_genre_department(root, "Jazz");
+                    })));
+        EXPECT_CALL(reply, register_category("albums", _, _, _))
+            .WillOnce(Return(albums_category));
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(_)))
+            .WillRepeatedly(Return(true));
+
+        SearchReplyProxy proxy(&reply, [](SearchReply*){});
+        query->run(proxy);
+    }
+}
+
+/* The scope may start before the mediascanner database exists; nothing
+   cached while its state is unknown may outlive its creation */
+TEST_F(MusicScopeTest, StoreCreatedAfterStart) {
+    scope->stop();
+    store.reset();
+    std::string cmd = "rm -f " + cachedir + "/mediastore.db*";
+    ASSERT_EQ(0, system(cmd.c_str()));
+    scope->start("mediascanner-music");
+    EXPECT_EQ(0u, mediastore_generation());
+
+    populateStore();
+    store.reset(new MediaStore(MS_READ_WRITE));
+    EXPECT_NE(0u, mediastore_generation());
+
+    Category::SCPtr albums_category = std::make_shared<unity::scopes::testing::Category>(
+        "albums", "", "icon", CategoryRenderer());
+    auto const run_genre_query = [this, &albums_category](bool expect_jazz) {
+        auto query = scope->search(CannedQuery("mediascanner-music", "", "genre:Rock"), SearchMetadata("en_AU", "phone"));
+        unity::scopes::testing::MockSearchReply reply;
+        EXPECT_CALL(reply, register_departments(Truly([expect_jazz](Department::SCPtr const& root) -> bool {
+                        return has_genre_department(root, "Rock") && has_genre_department(root, "Jazz") == expect_jazz;
+                    })));
+        EXPECT_CALL(reply, register_category("albums", _, _, _))
+            .WillOnce(Return(albums_category));
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(_)))
+            .WillRepeatedly(Return(true));
+
+        SearchReplyProxy proxy(&reply, [](SearchReply*){});
+        query->run(proxy);
+    };
+    run_genre_query(false);
+
+    {
+        MediaFileBuilder builder("/path/foo8.ogg");
+        builder.setType(AudioMedia);
+        builder.setGenre("Jazz");
+        builder.setTitle("So What");
+        builder.setAuthor("Miles Davis");
+        builder.setAlbum("Kind of Blue");
+        builder.setTrackNumber(1);
+        builder.setDuration(562);
+        store->insert(builder.build());
+    }
+    run_genre_query(true);
+}
+
 TEST_F(MusicScopeTest, AggregatedSurfacingQuery) {
     populateStore();
 
@@ -408,6 +960,38 @@ TEST_F(MusicScopeTest, AggregatedSurfacingQuery) {
     query->run(proxy);
 }
 
+TEST_F(MusicScopeTest, AggregatedSurfacingCardinality) {
+    populateStore();
+
+    CannedQuery q("mediascanner-music", "", "");
+    SearchMetadata hints("en_AU", "phone");
+    hints.set_aggregated_keywords(std::set<std::string>());
+    hints.set_cardinality(3);
+    auto query = scope->search(q, hints);
+
+    Category::SCPtr category = std::make_shared<unity::scopes::testing::Category>(
+        "mymusic", "My Music", "icon", CategoryRenderer());
+    unity::scopes::testing::MockSearchReply reply;
+    EXPECT_CALL(reply, register_category("mymusic", _, _, _, _))
+        .WillOnce(Return(category));
+
+    std::vector<CategorisedResult> cards;
+    EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(_)))
+        .Times(3)
+        .WillRepeatedly(Invoke([&cards](CategorisedResult const& res) -> bool {
+                    cards.push_back(res);
+                    return true;
+                }));
+
+    SearchReplyProxy proxy(&reply, [](SearchReply*){});
+    query->run(proxy);
+
+    // only the requested number of cards is built, but playing one of
+    // them still queues every song
+    ASSERT_EQ(3u, cards.size());
+    EXPECT_EQ(7u, cards[0]["audio-data"].get_dict().at("playlist").get_array().size());
+}
+
 TEST_F(MusicScopeTest, AggregatedSearchQuery) {
     populateStore();
 
@@ -579,6 +1163,71 @@ TEST_F(MusicScopeTest, PreviewAlbum) {
     previewer->run(proxy);
 }
 
+TEST_F(MusicScopeTest, CancelledAlbumPreview) {
+    populateStore();
+
+    unity::scopes::testing::Result result;
+    result.set_uri("album:///The%20John%20Butler%20Trio/April%20Uprising");
+    result.set_title("April Uprising");
+    result["artist"] = "The John Butler Trio";
+    result["album"] = "April Uprising";
+    result["isalbum"] = true;
+
+    ActionMetadata hints("en_AU", "phone");
+    auto previewer = scope->preview(result, hints);
+    previewer->cancelled();
+
+    unity::scopes::testing::MockPreviewReply reply;
+    EXPECT_CALL(reply, register_layout(_))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(reply, push(Matcher<PreviewWidgetList const&>(_)))
+        .Times(0);
+
+    PreviewReplyProxy proxy(&reply, [](PreviewReply*){});
+    previewer->run(proxy);
+}
+
+/* Cancelled from another thread while the tracks of a large album are
+   fetched and added to the preview */
+TEST_F(MusicScopeTest, AlbumPreviewCancelledWhileFetchingTracks) {
+    for (int i = 0; i < 1000; i++) {
+        const std::string n = std::to_string(i);
+        MediaFileBuilder builder("/path/long" + n + ".ogg");
+        builder.setType(AudioMedia);
+        builder.setTitle("Part " + n);
+        builder.setAuthor("Long Player");
+        builder.setAlbum("Box Set");
+        builder.setTrackNumber(i + 1);
+        builder.setDuration(60);
+        store->insert(builder.build());
+    }
+
+    unity::scopes::testing::Result result;
+    result.set_uri("album:///Long%20Player/Box%20Set");
+    result.set_title("Box Set");
+    result["artist"] = "Long Player";
+    result["album"] = "Box Set";
+    result["isalbum"] = true;
+
+    ActionMetadata hints("en_AU", "phone");
+    auto previewer = scope->preview(result, hints);
+
+    // the layout is registered right before the tracks are fetched
+    std::thread canceller;
+    unity::scopes::testing::MockPreviewReply reply;
+    EXPECT_CALL(reply, register_layout(_))
+        .WillOnce(Invoke([&previewer, &canceller](ColumnLayoutList const&) -> bool {
+                    canceller = std::thread([&previewer]() { previewer->cancelled(); });
+                    return true;
+                }));
+    EXPECT_CALL(reply, push(Matcher<PreviewWidgetList const&>(_)))
+        .Times(0);
+
+    PreviewReplyProxy proxy(&reply, [](PreviewReply*){});
+    previewer->run(proxy);
+    canceller.join();
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -0,0 +1,194 @@
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../src/utils/requestcoalescer.h"
+
+typedef RequestCoalescer<std::string> Coalescer;
+
+// a fetch that only completes once the test opens the gate
+class Gate {
+public:
+    void open() { opened = true; }
+    void wait() const {
+        while (!opened) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+private:
+    std::atomic<bool> opened{false};
+};
+
+// long enough for the other callers to join the request in flight
+static void let_callers_join() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+}
+
+/* Concurrent callers for the same key share a single fetch */
+TEST(RequestCoalescerTest, SharedFetch) {
+    Coalescer coalescer;
+    Gate gate;
+    std::atomic<int> fetches(0);
+    auto const fetch = [&gate, &fetches](Coalescer::Abandoned const&) -> std::string {
+        fetches++;
+        gate.wait();
+        return "biography";
+    };
+
+    const int callers = 4;
+    std::vector<std::atomic<bool>> cancelled(callers);
+    std::vector<std::string> results(callers);
+    std::vector<int> succeeded(callers, 0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < callers; i++) {
+        cancelled[i] = false;
+        threads.emplace_back([&, i]() {
+                succeeded[i] = coalescer.run("artist", cancelled[i], fetch, results[i]);
+            });
+    }
+    let_callers_join();
+    gate.open();
+    for (auto& thread: threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(1, fetches);
+    for (int i = 0; i < callers; i++) {
+        EXPECT_TRUE(succeeded[i]);
+        EXPECT_EQ("biography", results[i]);
+    }
+}
+
+/* A cancelled follower returns right away, the fetch carries on for the
+   leader */
+TEST(RequestCoalescerTest, FollowerCancels) {
+    Coalescer coalescer;
+    Gate gate;
+    std::atomic<bool> abandoned_after_cancel(true);
+    auto const fetch = [&gate, &abandoned_after_cancel](Coalescer::Abandoned const& abandoned) -> std::string {
+        gate.wait();
+        abandoned_after_cancel = abandoned();
+        return "biography";
+    };
+
+    std::atomic<bool> leader_cancelled(false);
+    std::string leader_result;
+    bool leader_succeeded = false;
+    std::thread leader([&]() {
+            leader_succeeded = coalescer.run("artist", leader_cancelled, fetch, leader_result);
+        });
+    let_callers_join();
+
+    std::atomic<bool> follower_cancelled(false);
+    std::string follower_result = "untouched";
+    bool follower_succeeded = true;
+    std::thread follower([&]() {
+            follower_succeeded = coalescer.run("artist", follower_cancelled, fetch, follower_result);
+        });
+    let_callers_join();
+    follower_cancelled = true;
+    follower.join();
+    EXPECT_FALSE(follower_succeeded);
+    EXPECT_EQ("untouched", follower_result);
+
+    gate.open();
+    leader.join();
+    EXPECT_FALSE(abandoned_after_cancel);
+    EXPECT_TRUE(leader_succeeded);
+    EXPECT_EQ("biography", leader_result);
+}
+
+/* Once every waiting caller is cancelled the fetch is told to give up */
+TEST(RequestCoalescerTest, AllCancelled) {
+    Coalescer coalescer;
+    std::atomic<bool> gave_up(false);
+    auto const fetch = [&gave_up](Coalescer::Abandoned const& abandoned) -> std::string {
+        auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!abandoned() && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        gave_up = abandoned();
+        return "partial";
+    };
+
+    std::atomic<bool> leader_cancelled(false);
+    std::atomic<bool> follower_cancelled(false);
+    std::string leader_result = "untouched";
+    std::string follower_result = "untouched";
+    bool leader_succeeded = true;
+    bool follower_succeeded = true;
+    std::thread leader([&]() {
+            leader_succeeded = coalescer.run("artist", leader_cancelled, fetch, leader_result);
+        });
+    let_callers_join();
+    std::thread follower([&]() {
+            follower_succeeded = coalescer.run("artist", follower_cancelled, fetch, follower_result);
+        });
+    let_callers_join();
+
+    leader_cancelled = true;
+    let_callers_join();
+    EXPECT_FALSE(gave_up);
+    follower_cancelled = true;
+    leader.join();
+    follower.join();
+
+    EXPECT_TRUE(gave_up);
+    EXPECT_FALSE(leader_succeeded);
+    EXPECT_FALSE(follower_succeeded);
+    EXPECT_EQ("untouched", leader_result);
+    EXPECT_EQ("untouched", follower_result);
+}
+
+/* An exception thrown by the fetch reaches every waiting caller */
+TEST(RequestCoalescerTest, ExceptionPassedOn) {
+    Coalescer coalescer;
+    Gate gate;
+    auto const fetch = [&gate](Coalescer::Abandoned const&) -> std::string {
+        gate.wait();
+        throw std::runtime_error("no network");
+    };
+
+    const int callers = 3;
+    std::vector<std::atomic<bool>> cancelled(callers);
+    std::vector<std::string> errors(callers);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < callers; i++) {
+        cancelled[i] = false;
+        threads.emplace_back([&, i]() {
+                std::string result;
+                try {
+                    coalescer.run("artist", cancelled[i], fetch, result);
+                } catch (const std::runtime_error &e) {
+                    errors[i] = e.what();
+                }
+            });
+    }
+    let_callers_join();
+    gate.open();
+    for (auto& thread: threads) {
+        thread.join();
+    }
+
+    for (auto const& error: errors) {
+        EXPECT_EQ("no network", error);
+    }
+
+    // the failed request is not remembered
+    std::atomic<bool> not_cancelled(false);
+    std::string result;
+    EXPECT_TRUE(coalescer.run("artist", not_cancelled, [](Coalescer::Abandoned const&) {
+                return std::string("retried");
+            }, result));
+    EXPECT_EQ("retried", result);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,338 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <unity/scopes/CompletionDetails.h>
+#include <unity/scopes/testing/Category.h>
+#include <unity/scopes/testing/MockSearchReply.h>
+
+#include "../src/utils/aggregatorchildsearches.h"
+#include "../src/utils/bufferedresultforwarder.h"
+#include "../src/utils/childcategoryforwarder.h"
+#include "../src/utils/childstats.h"
+#include "../src/utils/filteredresultforwarder.h"
+
+using namespace unity::scopes;
+using ::testing::_;
+using ::testing::Invoke;
+using ::testing::Matcher;
+
+class ResultForwarderTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        pushed = 0;
+        proxy = SearchReplyProxy(&reply, [](SearchReply*){});
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(_)))
+            .WillRepeatedly(Invoke([this](CategorisedResult const&) -> bool {
+                        pushed++;
+                        return true;
+                    }));
+    }
+
+    CategorisedResult make_result(std::string const& uri) {
+        CategorisedResult res(category);
+        res.set_uri(uri);
+        res.set_title(uri);
+        return res;
+    }
+
+    Category::SCPtr category = std::make_shared<unity::scopes::testing::Category>(
+        "cat", "Category", "icon", CategoryRenderer());
+    unity::scopes::testing::MockSearchReply reply;
+    SearchReplyProxy proxy;
+    std::atomic<int> pushed;
+};
+
+/* A child that doesn't finish in time no longer holds up the next ones */
+TEST_F(ResultForwarderTest, DeadlineReleasesChain) {
+    auto second = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+    auto first = std::make_shared<BufferedResultForwarder>(proxy, second);
+    first->set_deadline(std::chrono::milliseconds(50));
+
+    second->push(make_result("file:///second"));
+    second->finished(CompletionDetails(CompletionDetails::OK));
+    EXPECT_EQ(0, pushed);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    EXPECT_TRUE(first->deadline_expired());
+    EXPECT_EQ(1, pushed);
+
+    // late results of the slow child are appended
+    first->push(make_result("file:///first"));
+    EXPECT_EQ(2, pushed);
+}
+
+TEST_F(ResultForwarderTest, DeadlineDropsLateResults) {
+    auto first = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+    first->set_deadline(std::chrono::milliseconds(20), BufferedResultForwarder::LateResults::Drop);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    first->push(make_result("file:///late"));
+    EXPECT_EQ(0, pushed);
+}
+
+/* Finishing in time cancels the deadline without waiting for it */
+TEST_F(ResultForwarderTest, FinishedBeforeDeadline) {
+    auto const start = std::chrono::steady_clock::now();
+    {
+        auto second = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+        auto first = std::make_shared<BufferedResultForwarder>(proxy, second);
+        first->set_deadline(std::chrono::seconds(10));
+
+        first->push(make_result("file:///first"));
+        first->finished(CompletionDetails(CompletionDetails::OK));
+        second->push(make_result("file:///second"));
+        EXPECT_EQ(2, pushed);
+        EXPECT_FALSE(first->deadline_expired());
+    }
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+}
+
+/* A child sending more than its cardinality doesn't fill the buffer */
+TEST_F(ResultForwarderTest, ResultLimit) {
+    auto second = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+    auto first = std::make_shared<BufferedResultForwarder>(proxy, second);
+    second->set_result_limit(3);
+
+    for (int i = 0; i < 10; i++) {
+        second->push(make_result("file:///" + std::to_string(i)));
+    }
+    second->finished(CompletionDetails(CompletionDetails::OK));
+    EXPECT_EQ(0, pushed);
+    EXPECT_EQ(7u, second->dropped_results());
+
+    first->finished(CompletionDetails(CompletionDetails::OK));
+    EXPECT_EQ(3, pushed);
+    EXPECT_EQ(0u, first->dropped_results());
+}
+
+/* Children with injected latencies: the second one waits for the first */
+TEST_F(ResultForwarderTest, ChildStats) {
+    auto const start = std::chrono::steady_clock::now();
+    auto second = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+    auto first = std::make_shared<BufferedResultForwarder>(proxy, second, [](CategorisedResult& res) -> bool {
+            return res.uri() != "file:///filtered";
+        });
+    first->mark_dispatched();
+    second->mark_dispatched();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    second->push(make_result("file:///second"));
+    second->finished(CompletionDetails(CompletionDetails::OK));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    first->push(make_result("file:///first"));
+    first->push(make_result("file:///filtered"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    first->finished(CompletionDetails(CompletionDetails::OK));
+    EXPECT_EQ(2, pushed);
+
+    auto const stats = child_search_stats(start, {{"first", first}, {"second", second}});
+    ASSERT_EQ(2u, stats.size());
+    EXPECT_EQ("first", stats[0].child_id);
+    EXPECT_GE(stats[0].first_result_ms, 100);
+    EXPECT_GE(stats[0].finished_ms, 150);
+    EXPECT_EQ(0, stats[0].chain_wait_ms);
+    EXPECT_EQ(2u, stats[0].received);
+    EXPECT_EQ(1u, stats[0].filtered);
+
+    EXPECT_GE(stats[1].first_result_ms, 50);
+    EXPECT_GE(stats[1].chain_wait_ms, 90);
+    EXPECT_EQ(1u, stats[1].received);
+    EXPECT_EQ(0u, stats[1].filtered);
+    EXPECT_FALSE(stats[1].deadline_expired);
+}
+
+/* Results of a child all go to one category, registered on the first result */
+TEST_F(ResultForwarderTest, ChildCategory) {
+    Category::SCPtr other = std::make_shared<unity::scopes::testing::Category>(
+        "other", "Other", "icon", CategoryRenderer());
+    Category::SCPtr aggregated = std::make_shared<unity::scopes::testing::Category>(
+        "child", "Results from Child", "icon", CategoryRenderer());
+    int registered = 0;
+    auto forwarder = std::make_shared<ChildCategoryForwarder>(proxy, nullptr,
+        [&](CategorisedResult const& first) -> Category::SCPtr {
+            EXPECT_EQ("cat", first.category()->id());
+            registered++;
+            return aggregated;
+        });
+
+    forwarder->push(make_result("file:///one"));
+    CategorisedResult misplaced(other);
+    misplaced.set_uri("file:///other");
+    misplaced.set_title("other");
+    forwarder->push(misplaced);
+    forwarder->push(make_result("file:///two"));
+
+    EXPECT_EQ(1, registered);
+    EXPECT_EQ(2, pushed);
+}
+
+TEST_F(ResultForwarderTest, PushBenchmark) {
+    const int children = 5;
+    const int results_per_child = 2000;
+    Category::SCPtr aggregated = std::make_shared<unity::scopes::testing::Category>(
+        "child", "Results from Child", "icon", CategoryRenderer());
+
+    std::vector<std::shared_ptr<BufferedResultForwarder>> chain;
+    std::shared_ptr<BufferedResultForwarder> next;
+    for (int i = 0; i < children; i++) {
+        next = std::make_shared<ChildCategoryForwarder>(proxy, next,
+            [aggregated](CategorisedResult const&) { return aggregated; });
+        chain.push_back(next);
+    }
+    std::vector<CategorisedResult> results;
+    for (int i = 0; i < results_per_child; i++) {
+        results.push_back(make_result("file:///" + std::to_string(i)));
+    }
+
+    // push from the last child first, so most results are buffered
+    typedef std::chrono::steady_clock clock;
+    auto const start = clock::now();
+    for (auto const& forwarder : chain) {
+        for (auto const& res : results) {
+            forwarder->push(res);
+        }
+        forwarder->finished(CompletionDetails(CompletionDetails::OK));
+    }
+    auto const elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+    RecordProperty("push_us", elapsed_us);
+    std::cout << children * results_per_child << " results forwarded in " << elapsed_us << "us" << std::endl;
+
+    EXPECT_EQ(children * results_per_child, pushed);
+}
+
+TEST_F(ResultForwarderTest, FilteredForwarder) {
+    auto forwarder = make_filtered_forwarder(proxy, nullptr, [](CategorisedResult& res) -> bool {
+            return res.uri() != "file:///dropped";
+        });
+    forwarder->push(make_result("file:///kept"));
+    forwarder->push(make_result("file:///dropped"));
+    EXPECT_EQ(1, pushed);
+
+    forwarder->cancel();
+    forwarder->push(make_result("file:///kept"));
+    EXPECT_EQ(1, pushed);
+}
+
+/* Cancelling doesn't keep the buffered results around until the children finish */
+TEST_F(ResultForwarderTest, CancelReleasesBuffer) {
+    auto second = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+    auto first = std::make_shared<BufferedResultForwarder>(proxy, second);
+    second->push(make_result("file:///buffered"));
+    EXPECT_EQ(0, pushed);
+
+    first->cancel();
+    second->cancel();
+    // handed to the reply, which was cancelled along with the query
+    EXPECT_EQ(1, pushed);
+
+    second->push(make_result("file:///late"));
+    first->finished(CompletionDetails(CompletionDetails::Cancelled));
+    second->finished(CompletionDetails(CompletionDetails::Cancelled));
+    EXPECT_EQ(1, pushed);
+}
+
+/* The stats outlive the forwarders of a cancelled query */
+TEST_F(ResultForwarderTest, CancelledChildSearches) {
+    AggregatorChildSearches searches(CannedQuery("aggregator", "query", ""), SearchMetadata("en", "phone"), nullptr);
+    searches.start();
+    SearchMetadata metadata("en", "phone");
+    auto forwarder = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+    std::weak_ptr<BufferedResultForwarder> released = forwarder;
+    searches.dispatching("child", metadata, forwarder);
+    searches.track(nullptr, forwarder);
+    forwarder->push(make_result("file:///one"));
+
+    searches.cancel();
+    forwarder->finished(CompletionDetails(CompletionDetails::Cancelled));
+    forwarder.reset();
+    EXPECT_TRUE(released.expired());
+
+    auto const stats = searches.stats();
+    ASSERT_EQ(1u, stats.size());
+    EXPECT_EQ("child", stats[0].child_id);
+    EXPECT_EQ(1u, stats[0].received);
+    EXPECT_GE(stats[0].finished_ms, 0);
+}
+
+template <typename Forwarder>
+static long push_all(Forwarder& forwarder, std::vector<CategorisedResult> const& results)
+{
+    typedef std::chrono::steady_clock clock;
+    auto const start = clock::now();
+    for (auto const& res : results) {
+        forwarder->push(res);
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+}
+
+/* Same filters as the music aggregator uses for its predefined children */
+TEST_F(ResultForwarderTest, FilterBenchmark) {
+    const int count = 10000;
+    Category::SCPtr aggregated = std::make_shared<unity::scopes::testing::Category>(
+        "aggregated", "Aggregated", "icon", CategoryRenderer());
+    std::vector<CategorisedResult> results;
+    for (int i = 0; i < count; i++) {
+        auto res = make_result("file:///" + std::to_string(i));
+        res["musicaggregation"] = Variant(i % 2 == 0);
+        results.push_back(res);
+    }
+
+    auto soundcloud = [aggregated](CategorisedResult& res) -> bool {
+        if (res.category()->id() == "soundcloud_login_nag") {
+            return false;
+        }
+        res.set_category(aggregated);
+        return true;
+    };
+    auto songkick = [aggregated](CategorisedResult& res) -> bool {
+        if (res.category()->id() == "noloc") {
+            return false;
+        }
+        res.set_category(aggregated);
+        return true;
+    };
+    auto youtube = [aggregated](CategorisedResult& res) -> bool {
+        res.set_category(aggregated);
+        return !res["musicaggregation"].is_null();
+    };
+
+    auto erased = std::make_shared<BufferedResultForwarder>(proxy, nullptr, soundcloud);
+    auto filtered = make_filtered_forwarder(proxy, nullptr, soundcloud);
+    long const soundcloud_erased_us = push_all(erased, results);
+    long const soundcloud_filtered_us = push_all(filtered, results);
+
+    erased = std::make_shared<BufferedResultForwarder>(proxy, nullptr, songkick);
+    auto filtered_songkick = make_filtered_forwarder(proxy, nullptr, songkick);
+    long const songkick_erased_us = push_all(erased, results);
+    long const songkick_filtered_us = push_all(filtered_songkick, results);
+
+    erased = std::make_shared<BufferedResultForwarder>(proxy, nullptr, youtube);
+    auto filtered_youtube = make_filtered_forwarder(proxy, nullptr, youtube);
+    long const youtube_erased_us = push_all(erased, results);
+    long const youtube_filtered_us = push_all(filtered_youtube, results);
+
+    RecordProperty("soundcloud_erased_us", soundcloud_erased_us);
+    RecordProperty("soundcloud_filtered_us", soundcloud_filtered_us);
+    RecordProperty("songkick_erased_us", songkick_erased_us);
+    RecordProperty("songkick_filtered_us", songkick_filtered_us);
+    RecordProperty("youtube_erased_us", youtube_erased_us);
+    RecordProperty("youtube_filtered_us", youtube_filtered_us);
+    std::cout << count << " results, std::function vs template filter:" << std::endl
+              << "  soundcloud: " << soundcloud_erased_us << "us / " << soundcloud_filtered_us << "us" << std::endl
+              << "  songkick: " << songkick_erased_us << "us / " << songkick_filtered_us << "us" << std::endl
+              << "  youtube: " << youtube_erased_us << "us / " << youtube_filtered_us << "us" << std::endl;
+
+    EXPECT_EQ(6 * count, pushed);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
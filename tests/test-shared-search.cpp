@@ -0,0 +1,256 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <unity/scopes/CompletionDetails.h>
+#include <unity/scopes/Location.h>
+#include <unity/scopes/SearchMetadata.h>
+#include <unity/scopes/testing/Category.h>
+#include <unity/scopes/testing/MockSearchReply.h>
+
+#include "../src/utils/bufferedresultforwarder.h"
+#include "../src/utils/sharedsearch.h"
+
+using namespace unity::scopes;
+using ::testing::_;
+using ::testing::Invoke;
+using ::testing::Matcher;
+using ::testing::Return;
+
+// collects what is pushed on the reply of a follower, which happens on a thread of its own
+class FollowerReply {
+public:
+    FollowerReply() : proxy(&reply, [](SearchReply*){}) {
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(_)))
+            .WillRepeatedly(Invoke([this](CategorisedResult const& res) -> bool {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        uris.push_back(res.uri());
+                        threads.push_back(std::this_thread::get_id());
+                        cond.notify_all();
+                        return true;
+                    }));
+    }
+
+    std::vector<std::string> wait_for(unsigned count) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait_for(lock, std::chrono::seconds(5), [this, count] { return uris.size() >= count; });
+        return uris;
+    }
+
+    unity::scopes::testing::MockSearchReply reply;
+    SearchReplyProxy proxy;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<std::string> uris;
+    std::vector<std::thread::id> threads;
+};
+
+class SharedSearchTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        proxy = SearchReplyProxy(&reply, [](SearchReply*){});
+        EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(_)))
+            .WillRepeatedly(Return(true));
+    }
+
+    CategorisedResult make_result(std::string const& uri) {
+        CategorisedResult res(category);
+        res.set_uri(uri);
+        res.set_title(uri);
+        return res;
+    }
+
+    Category::SCPtr category = std::make_shared<unity::scopes::testing::Category>(
+        "cat", "Category", "icon", CategoryRenderer());
+    unity::scopes::testing::MockSearchReply reply;
+    SearchReplyProxy proxy;
+};
+
+/* A follower gets the leader's categories and results, in the same order */
+TEST_F(SharedSearchTest, Replay) {
+    auto shared = std::make_shared<SharedSearch>();
+    shared->record_category(category);
+    auto last = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+    auto first = std::make_shared<BufferedResultForwarder>(proxy, last);
+    shared->record_child(*last);
+    shared->record_child(*first);
+    shared->dispatched();
+
+    last->push(make_result("file:///last"));
+    last->finished(CompletionDetails(CompletionDetails::OK));
+    first->push(make_result("file:///first"));
+    EXPECT_FALSE(shared->complete());
+    first->finished(CompletionDetails(CompletionDetails::OK));
+    EXPECT_TRUE(shared->complete());
+
+    unity::scopes::testing::MockSearchReply follower;
+    SearchReplyProxy follower_proxy(&follower, [](SearchReply*){});
+    EXPECT_CALL(follower, register_category("cat", "Category", "icon", _))
+        .WillOnce(Return(category));
+    std::vector<std::string> uris;
+    EXPECT_CALL(follower, push(Matcher<CategorisedResult const&>(_)))
+        .WillRepeatedly(Invoke([&uris](CategorisedResult const& res) -> bool {
+                    uris.push_back(res.uri());
+                    return true;
+                }));
+    std::atomic<bool> cancelled(false);
+    EXPECT_TRUE(shared->follow(follower_proxy, cancelled, std::chrono::milliseconds(0), nullptr));
+    EXPECT_EQ(std::vector<std::string>({"file:///first", "file:///last"}), uris);
+}
+
+/* A follower does not wait for the children; it gets the results once they are done */
+TEST_F(SharedSearchTest, Follower) {
+    auto shared = std::make_shared<SharedSearch>();
+    auto forwarder = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+    shared->record_child(*forwarder);
+    shared->dispatched();
+
+    FollowerReply follower;
+    std::atomic<bool> cancelled(false);
+    EXPECT_TRUE(shared->follow(follower.proxy, cancelled, std::chrono::seconds(5), nullptr));
+
+    forwarder->push(make_result("file:///result"));
+    forwarder->finished(CompletionDetails(CompletionDetails::OK));
+    EXPECT_EQ(std::vector<std::string>({"file:///result"}), follower.wait_for(1));
+    // not on the thread of the child's reply
+    std::lock_guard<std::mutex> lock(follower.mutex);
+    EXPECT_NE(std::this_thread::get_id(), follower.threads.at(0));
+}
+
+/* Once the timeout passes, a follower gets what has been received so far */
+TEST_F(SharedSearchTest, FollowerTimeout) {
+    auto shared = std::make_shared<SharedSearch>();
+    auto forwarder = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+    shared->record_child(*forwarder);
+    shared->dispatched();
+    forwarder->push(make_result("file:///early"));
+
+    FollowerReply follower;
+    std::atomic<bool> cancelled(false);
+    EXPECT_TRUE(shared->follow(follower.proxy, cancelled, std::chrono::milliseconds(50), nullptr));
+    EXPECT_EQ(std::vector<std::string>({"file:///early"}), follower.wait_for(1));
+
+    forwarder->push(make_result("file:///late"));
+    forwarder->finished(CompletionDetails(CompletionDetails::OK));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::lock_guard<std::mutex> lock(follower.mutex);
+    EXPECT_EQ(std::vector<std::string>({"file:///early"}), follower.uris);
+}
+
+/* A follower whose leader is cancelled once dispatched searches on its own, and leads that search */
+TEST_F(SharedSearchTest, LeaderCancelledAfterDispatch) {
+    auto coalescer = std::make_shared<SearchCoalescer>(std::chrono::seconds(30));
+    bool leader = false;
+    auto shared = coalescer->join("search", false, leader);
+    ASSERT_TRUE(leader);
+    auto forwarder = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+    shared->record_child(*forwarder);
+    shared->dispatched();
+    forwarder->push(make_result("file:///partial"));
+
+    ASSERT_EQ(shared, coalescer->join("search", false, leader));
+    ASSERT_FALSE(leader);
+    FollowerReply follower;
+    std::atomic<bool> cancelled(false);
+    std::promise<bool> searched;
+    EXPECT_TRUE(shared->follow(follower.proxy, cancelled, std::chrono::seconds(5), [&coalescer, &searched]() {
+                bool leader = false;
+                coalescer->join("search", false, leader);
+                searched.set_value(leader);
+            }));
+
+    // the leader is cancelled, and its children with it
+    shared->abandon();
+    forwarder->finished(CompletionDetails(CompletionDetails::Cancelled));
+    auto result = searched.get_future();
+    ASSERT_EQ(std::future_status::ready, result.wait_for(std::chrono::seconds(5)));
+    EXPECT_TRUE(result.get());
+    std::lock_guard<std::mutex> lock(follower.mutex);
+    EXPECT_TRUE(follower.uris.empty());
+}
+
+/* A leader leaving before it dispatched its search lets the followers search on their own */
+TEST_F(SharedSearchTest, AbandonedLeader) {
+    auto shared = std::make_shared<SharedSearch>();
+    auto forwarder = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+    {
+        SharedSearchGuard guard(shared);
+        shared->record_child(*forwarder);
+    }
+
+    std::atomic<bool> cancelled(false);
+    EXPECT_FALSE(shared->follow(proxy, cancelled, std::chrono::seconds(5), nullptr));
+    forwarder->finished(CompletionDetails(CompletionDetails::Cancelled));
+    EXPECT_FALSE(shared->complete());
+}
+
+TEST_F(SharedSearchTest, Coalescer) {
+    auto coalescer = std::make_shared<SearchCoalescer>(std::chrono::seconds(30));
+    bool leader = false;
+    auto surfacing = coalescer->join("surfacing", true, leader);
+    EXPECT_TRUE(leader);
+    EXPECT_EQ(surfacing, coalescer->join("surfacing", true, leader));
+    EXPECT_FALSE(leader);
+    auto search = coalescer->join("search", false, leader);
+    EXPECT_TRUE(leader);
+
+    // complete surfacing searches are cached, the others forgotten
+    surfacing->dispatched();
+    search->dispatched();
+    EXPECT_EQ(surfacing, coalescer->join("surfacing", true, leader));
+    EXPECT_FALSE(leader);
+    EXPECT_NE(search, coalescer->join("search", false, leader));
+    EXPECT_TRUE(leader);
+}
+
+/* A page missing the results of a failed child is not cached */
+TEST_F(SharedSearchTest, FailedChild) {
+    auto coalescer = std::make_shared<SearchCoalescer>(std::chrono::seconds(30));
+    bool leader = false;
+    auto surfacing = coalescer->join("surfacing", true, leader);
+    EXPECT_TRUE(leader);
+    auto forwarder = std::make_shared<BufferedResultForwarder>(proxy, nullptr);
+    surfacing->record_child(*forwarder);
+    surfacing->dispatched();
+    forwarder->finished(CompletionDetails(CompletionDetails::Error));
+    EXPECT_TRUE(surfacing->complete());
+    EXPECT_TRUE(surfacing->failed());
+
+    EXPECT_NE(surfacing, coalescer->join("surfacing", true, leader));
+    EXPECT_TRUE(leader);
+}
+
+/* Queries the children may answer differently do not share a search */
+TEST_F(SharedSearchTest, Key) {
+    const CannedQuery query("scope", "query", "");
+    const ChildScopeList children;
+    const SearchMetadata metadata(20, "en_US", "phone");
+    const auto key = shared_search_key(query, metadata, children);
+    EXPECT_EQ(key, shared_search_key(query, SearchMetadata(20, "en_US", "phone"), children));
+
+    EXPECT_NE(key, shared_search_key(query, SearchMetadata(40, "en_US", "phone"), children));
+
+    SearchMetadata located(metadata);
+    located.set_location(Location(51.5, -0.12));
+    EXPECT_NE(key, shared_search_key(query, located, children));
+    SearchMetadata elsewhere(metadata);
+    elsewhere.set_location(Location(48.85, 2.35));
+    EXPECT_NE(shared_search_key(query, located, children), shared_search_key(query, elsewhere, children));
+
+    SearchMetadata offline(metadata);
+    offline.set_internet_connectivity(QueryMetadata::Disconnected);
+    EXPECT_NE(key, shared_search_key(query, offline, children));
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,71 @@
+#include <atomic>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <mediascanner/Filter.hh>
+
+#include "../src/utils/storequery.h"
+
+/* The rows are fetched with one store query, whatever the limit */
+TEST(StoreQueryTest, SingleFetch) {
+    std::atomic<bool> cancelled(false);
+    int fetches = 0;
+    std::vector<int> seen;
+    EXPECT_TRUE(for_each_row(cancelled, mediascanner::Filter(), 100,
+            [&fetches](mediascanner::Filter const& f) {
+                fetches++;
+                EXPECT_EQ(0, f.getOffset());
+                EXPECT_EQ(100, f.getLimit());
+                return std::vector<int>{1, 2, 3};
+            },
+            [&seen](int row) -> bool {
+                seen.push_back(row);
+                return true;
+            }));
+    EXPECT_EQ(1, fetches);
+    EXPECT_EQ((std::vector<int>{1, 2, 3}), seen);
+}
+
+/* Cancelling while rows are handed out stops before the next row */
+TEST(StoreQueryTest, CancelBetweenRows) {
+    std::atomic<bool> cancelled(false);
+    std::vector<int> seen;
+    EXPECT_FALSE(for_each_row(cancelled, mediascanner::Filter(), 100,
+            [](mediascanner::Filter const&) { return std::vector<int>{1, 2, 3, 4}; },
+            [&cancelled, &seen](int row) -> bool {
+                seen.push_back(row);
+                if (row == 2) {
+                    cancelled = true;
+                }
+                return true;
+            }));
+    EXPECT_EQ((std::vector<int>{1, 2}), seen);
+}
+
+/* A query cancelled before the lookup doesn't touch the store */
+TEST(StoreQueryTest, CancelledBeforeFetch) {
+    std::atomic<bool> cancelled(true);
+    int fetches = 0;
+    EXPECT_FALSE(for_each_row(cancelled, mediascanner::Filter(), 100,
+            [&fetches](mediascanner::Filter const&) {
+                fetches++;
+                return std::vector<int>();
+            },
+            [](int) -> bool { return true; }));
+    EXPECT_EQ(0, fetches);
+}
+
+/* The row handler can stop early, e.g. when the reply is gone */
+TEST(StoreQueryTest, HandlerStops) {
+    std::atomic<bool> cancelled(false);
+    int handled = 0;
+    EXPECT_FALSE(for_each_row(cancelled, mediascanner::Filter(), 100,
+            [](mediascanner::Filter const&) { return std::vector<int>{1, 2, 3}; },
+            [&handled](int) -> bool { return ++handled < 2; }));
+    EXPECT_EQ(2, handled);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,85 @@
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <unity/scopes/SearchMetadata.h>
+
+#include "../src/utils/trace.h"
+
+using namespace unity::scopes;
+
+static std::string trace_file;
+
+static std::vector<std::string> trace_lines() {
+    std::ifstream in(trace_file);
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(in, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+/* The child logs under the trace id given by the aggregator */
+TEST(TraceTest, Propagation) {
+    SearchMetadata child_metadata("en_AU", "phone");
+    {
+        QueryTrace aggregator("musicaggregator", SearchMetadata("en_AU", "phone"));
+        ASSERT_TRUE(aggregator.enabled());
+        aggregator.propagate(child_metadata);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        QueryTrace child("mediascanner-music", child_metadata);
+        child.span("departments", QueryTrace::clock::now());
+        child.finish();
+        aggregator.finish();
+    }
+
+    auto const lines = trace_lines();
+    ASSERT_EQ(5u, lines.size());
+    EXPECT_EQ("[", lines[0]);
+    EXPECT_NE(std::string::npos, lines[1].find("\"name\":\"queued\",\"cat\":\"mediascanner-music\""));
+    EXPECT_NE(std::string::npos, lines[2].find("\"name\":\"departments\""));
+    EXPECT_NE(std::string::npos, lines[4].find("\"name\":\"query\",\"cat\":\"musicaggregator\""));
+
+    // every event has the same trace id
+    auto const id_start = lines[4].find("\"trace_id\":");
+    ASSERT_NE(std::string::npos, id_start);
+    auto const trace_id = lines[4].substr(id_start);
+    for (unsigned i = 1; i < lines.size(); i++) {
+        EXPECT_NE(std::string::npos, lines[i].find(trace_id)) << lines[i];
+    }
+}
+
+/* The query is logged once, when finished rather than when destroyed */
+TEST(TraceTest, Finish) {
+    auto const before = trace_lines().size();
+    {
+        QueryTrace finished("musicaggregator", SearchMetadata("en_AU", "phone"));
+        finished.finish();
+        EXPECT_EQ(before + 1, trace_lines().size());
+        finished.finish();
+        QueryTrace unfinished("musicaggregator", SearchMetadata("en_AU", "phone"));
+    }
+    auto const lines = trace_lines();
+    ASSERT_EQ(before + 1, lines.size());
+    EXPECT_NE(std::string::npos, lines.back().find("\"name\":\"query\""));
+}
+
+int main(int argc, char **argv) {
+    char path[] = "/tmp/mediascanner-trace-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    unlink(path);
+    trace_file = path;
+    setenv("MEDIASCANNER_SCOPE_TRACE_FILE", path, true);
+
+    ::testing::InitGoogleTest(&argc, argv);
+    int result = RUN_ALL_TESTS();
+    unlink(path);
+    return result;
+}
@@ -0,0 +1,125 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/time.h>
+#include <gtest/gtest.h>
+
+#include "../src/utils/ttlcache.h"
+
+class TtlCacheTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        tmpdir = "/tmp/ttlcache.XXXXXX";
+        // mkdtemp edits the string in place without changing its length
+        if (mkdtemp(const_cast<char*>(tmpdir.c_str())) == nullptr) {
+            throw std::runtime_error(strerror(errno));
+        }
+        cachedir = tmpdir + "/cache";
+    }
+
+    virtual void TearDown() {
+        std::string cmd = "rm -rf " + tmpdir;
+        ASSERT_EQ(0, system(cmd.c_str()));
+    }
+
+    std::vector<std::string> entries() const {
+        std::vector<std::string> names;
+        DIR *dir = opendir(cachedir.c_str());
+        if (!dir) {
+            return names;
+        }
+        while (struct dirent *entry = readdir(dir)) {
+            if (entry->d_name[0] != '.') {
+                names.push_back(cachedir + "/" + entry->d_name);
+            }
+        }
+        closedir(dir);
+        return names;
+    }
+
+    std::string tmpdir;
+    std::string cachedir;
+};
+
+TEST_F(TtlCacheTest, RoundTrip) {
+    TtlFileCache cache(cachedir, std::chrono::hours(1));
+    std::string value;
+    EXPECT_FALSE(cache.get("Spiderbait\nIvy and the Big Apples", value));
+
+    cache.put("Spiderbait\nIvy and the Big Apples", "Australian rock band");
+    EXPECT_TRUE(cache.get("Spiderbait\nIvy and the Big Apples", value));
+    EXPECT_EQ("Australian rock band", value);
+
+    // empty values are valid entries
+    cache.put("Spiderbait\nShashavaglava", "");
+    value = "unchanged";
+    EXPECT_TRUE(cache.get("Spiderbait\nShashavaglava", value));
+    EXPECT_EQ("", value);
+}
+
+/* Entries older than the ttl are ignored until they are written again */
+TEST_F(TtlCacheTest, Expiry) {
+    TtlFileCache cache(cachedir, std::chrono::hours(1));
+    cache.put("key", "old");
+    auto const files = entries();
+    ASSERT_EQ(1u, files.size());
+
+    struct timeval times[2];
+    gettimeofday(&times[0], nullptr);
+    times[0].tv_sec -= 2 * 60 * 60;
+    times[1] = times[0];
+    ASSERT_EQ(0, utimes(files[0].c_str(), times));
+
+    std::string value;
+    EXPECT_FALSE(cache.get("key", value));
+
+    cache.put("key", "new");
+    EXPECT_TRUE(cache.get("key", value));
+    EXPECT_EQ("new", value);
+}
+
+/* An entry file holding another key is not returned */
+TEST_F(TtlCacheTest, KeyCollisionGuard) {
+    TtlFileCache cache(cachedir, std::chrono::hours(1));
+    cache.put("first", "first value");
+    auto const first_files = entries();
+    ASSERT_EQ(1u, first_files.size());
+    cache.put("second", "second value");
+    auto files = entries();
+    ASSERT_EQ(2u, files.size());
+    auto const second_file = files[0] == first_files[0] ? files[1] : files[0];
+
+    // make the entry of "second" look like a hash collision with "first"
+    {
+        std::ifstream in(first_files[0], std::ios::binary);
+        std::ofstream out(second_file, std::ios::binary | std::ios::trunc);
+        out << in.rdbuf();
+    }
+
+    std::string value;
+    EXPECT_FALSE(cache.get("second", value));
+    EXPECT_TRUE(cache.get("first", value));
+    EXPECT_EQ("first value", value);
+}
+
+/* Failing to write is reported by put(), get() just misses */
+TEST_F(TtlCacheTest, UnwritableDirectory) {
+    // a regular file where the cache directory's parent should be
+    std::ofstream(tmpdir + "/file") << "not a directory";
+    TtlFileCache cache(tmpdir + "/file/cache", std::chrono::hours(1));
+
+    EXPECT_THROW(cache.put("key", "value"), std::runtime_error);
+    std::string value;
+    EXPECT_FALSE(cache.get("key", value));
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,51 @@
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "../src/videoaggregator/videoaggregatorscope.h"
+
+static const std::string YOUTUBE = "com.ubuntu.scopes.youtube_youtube";
+// found by its "videos" keyword
+static const std::string OTHER = "com.example.scopes.videos_videos";
+
+TEST(TestVideoAggregator, PredefinedChildCardinality) {
+    EXPECT_EQ(VideoAggregatorScope::surfacing_predefined_cardinality,
+              VideoAggregatorScope::child_cardinality(YOUTUBE, true, 0));
+    EXPECT_EQ(VideoAggregatorScope::search_predefined_cardinality,
+              VideoAggregatorScope::child_cardinality(YOUTUBE, false, 0));
+    EXPECT_EQ(VideoAggregatorScope::search_predefined_cardinality,
+              VideoAggregatorScope::child_cardinality(YOUTUBE, false, 100));
+}
+
+TEST(TestVideoAggregator, KeywordChildCardinality) {
+    EXPECT_EQ(VideoAggregatorScope::surfacing_other_cardinality,
+              VideoAggregatorScope::child_cardinality(OTHER, true, 0));
+    EXPECT_EQ(VideoAggregatorScope::search_other_cardinality,
+              VideoAggregatorScope::child_cardinality(OTHER, false, 0));
+    EXPECT_LT(VideoAggregatorScope::surfacing_other_cardinality,
+              VideoAggregatorScope::surfacing_predefined_cardinality);
+    EXPECT_LT(VideoAggregatorScope::search_other_cardinality,
+              VideoAggregatorScope::search_predefined_cardinality);
+}
+
+/* The shell asks for fewer results than the budget */
+TEST(TestVideoAggregator, SmallShellCardinality) {
+    EXPECT_EQ(2, VideoAggregatorScope::child_cardinality(YOUTUBE, true, 2));
+    EXPECT_EQ(2, VideoAggregatorScope::child_cardinality(YOUTUBE, false, 2));
+    EXPECT_EQ(2, VideoAggregatorScope::child_cardinality(OTHER, true, 2));
+    EXPECT_EQ(2, VideoAggregatorScope::child_cardinality(OTHER, false, 2));
+}
+
+/* The local videos only get what the shell asked for */
+TEST(TestVideoAggregator, LocalVideosCardinality) {
+    auto const& local = VideoAggregatorScope::local_videos_scope;
+    EXPECT_EQ(0, VideoAggregatorScope::child_cardinality(local, true, 0));
+    EXPECT_EQ(0, VideoAggregatorScope::child_cardinality(local, false, 0));
+    EXPECT_EQ(100, VideoAggregatorScope::child_cardinality(local, true, 100));
+    EXPECT_EQ(2, VideoAggregatorScope::child_cardinality(local, false, 2));
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
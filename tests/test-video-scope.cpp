@@ -21,6 +21,7 @@ using namespace unity::scopes;
 using ::testing::_;
 using ::testing::AllOf;
 using ::testing::ElementsAre;
+using ::testing::Invoke;
 using ::testing::Matcher;
 using ::testing::Property;
 using ::testing::Return;
@@ -182,6 +183,28 @@ TEST_F(VideoScopeTest, SurfacingQuery) {
     query->run(proxy);
 }
 
+TEST_F(VideoScopeTest, AggregatedSurfacingCardinality) {
+    populateStore();
+
+    CannedQuery q("mediascanner-video", "", "");
+    SearchMetadata hints("en_AU", "phone");
+    hints.set_aggregated_keywords(std::set<std::string>());
+    hints.set_cardinality(2);
+    auto query = scope->search(q, hints);
+
+    Category::SCPtr category = std::make_shared<unity::scopes::testing::Category>(
+        "local", "My Videos", "icon", CategoryRenderer());
+    unity::scopes::testing::MockSearchReply reply;
+    EXPECT_CALL(reply, register_category("local", _, _, _, _))
+        .WillOnce(Return(category));
+    EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(_)))
+        .Times(2)
+        .WillRepeatedly(Return(true));
+
+    SearchReplyProxy proxy(&reply, [](SearchReply*){});
+    query->run(proxy);
+}
+
 TEST_F(VideoScopeTest, CameraDepartmentQuery) {
     populateStore();
 
@@ -228,6 +251,62 @@ TEST_F(VideoScopeTest, DownloadsDepartmentQuery) {
     query->run(proxy);
 }
 
+TEST_F(VideoScopeTest, CancelledQuery) {
+    for (int i = 0; i < 300; i++) {
+        const std::string n = std::to_string(i);
+        MediaFileBuilder builder("/path/synthetic" + n + ".ogv");
+        builder.setType(VideoMedia);
+        builder.setTitle("Synthetic " + n);
+        builder.setDuration(60);
+        store->insert(builder.build());
+    }
+
+    CannedQuery q("mediascanner-video", "", "downloads");
+    SearchMetadata hints("en_AU", "phone");
+    auto query = scope->search(q, hints);
+
+    Category::SCPtr category = std::make_shared<unity::scopes::testing::Category>(
+        "local", "My Videos", "icon", CategoryRenderer());
+    unity::scopes::testing::MockSearchReply reply;
+    EXPECT_CALL(reply, register_departments(_));
+    EXPECT_CALL(reply, register_category("local", _, _, _))
+        .WillOnce(Return(category));
+
+    // no more results are produced once the query has been cancelled
+    int pushed = 0;
+    EXPECT_CALL(reply, push(Matcher<CategorisedResult const&>(_)))
+        .Times(30)
+        .WillRepeatedly(Invoke([&query, &pushed](CategorisedResult const&) -> bool {
+                    if (++pushed == 30) {
+                        query->cancelled();
+                    }
+                    return true;
+                }));
+
+    SearchReplyProxy proxy(&reply, [](SearchReply*){});
+    query->run(proxy);
+}
+
+TEST_F(VideoScopeTest, CancelledPreview) {
+    unity::scopes::testing::Result result;
+    result.set_uri("file:///xyz");
+    result.set_title("Video title");
+    result["duration"] = 42;
+
+    ActionMetadata hints("en_AU", "phone");
+    auto previewer = scope->preview(result, hints);
+    previewer->cancelled();
+
+    unity::scopes::testing::MockPreviewReply reply;
+    EXPECT_CALL(reply, register_layout(_))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(reply, push(Matcher<PreviewWidgetList const&>(_)))
+        .Times(0);
+
+    PreviewReplyProxy proxy(&reply, [](PreviewReply*){});
+    previewer->run(proxy);
+}
+
 TEST_F(VideoScopeTest, PreviewVideo) {
     unity::scopes::testing::Result result;
     result.set_uri("file:///xyz");